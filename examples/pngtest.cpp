@@ -1,7 +1,9 @@
 #include "Util.hpp"
 #include "improc/Filter.hpp"
 #include "improc/Label.hpp"
+#include "improc/LineProfile.hpp"
 #include "improc/Morphology.hpp"
+#include "io/FrameSequence.hpp"
 #include "io/PgmIO.hpp"
 #include "io/PngIO.hpp"
 #include "matrix/Statistics.hpp"
@@ -17,16 +19,6 @@ std::string format;
 
 void parse_commandline(char** argv);
 
-std::vector<std::string> generate_filenames(const std::string& format,
-                                            int32_t start,
-                                            int32_t count);
-
-std::vector<sipl::MatrixXb> read_video_dir(
-    const std::vector<std::string>& filenames);
-
-std::vector<sipl::Vector2i> bresenham(const sipl::Vector2i& p1,
-                                      const sipl::Vector2i& p2);
-
 double average_mass(const std::vector<sipl::Component>& cs);
 
 constexpr uint8_t THRESH_VAL = uint8_t(0.0875 * 255);
@@ -47,41 +39,51 @@ int main(int argc, char** argv)
 
     parse_commandline(argv);
 
-    // Read in PNG's, convert to grayscale
-    auto filenames = generate_filenames(format, img_start, img_count);
-    auto grays = read_video_dir(filenames);
+    // Read in PNG's, keeping only the grayscale pixels under the line of
+    // interest. Frames are numbered img_start..img_count inclusive
+    const int32_t nframes = img_count - img_start + 1;
+    const sipl::LineProfile line({start_x, start_y}, {end_x, end_y});
+    sipl::FrameSequence<uint8_t> frames(
+        format, img_start, nframes,
+        [&line](const std::string& f, sipl::MatrixXb& profile) {
+            profile = color_to_grayscale(line.sample(sipl::PngIO::read(f)));
+        });
 
-    // Compute background img
-    auto bg = sipl::average(grays);
+    // Compute background along the line
+    std::vector<sipl::MatrixXb> profiles;
+    profiles.reserve(nframes);
+    sipl::BackgroundModel<uint8_t> bg_model;
+    sipl::MatrixXb profile(0, 0);
+    while (frames.next(profile)) {
+        bg_model.update(profile);
+        profiles.push_back(std::move(profile));
+    }
+    auto bg = bg_model.background();
 
     // Compute sagittal view
-    auto points = bresenham({start_x, start_y}, {end_x, end_y});
-    sipl::MatrixXb slice_img(grays.size() * 2, points.size());
-    for (size_t i = 0; i < grays.size(); ++i) {
-
-        // Subtract background
-        auto diff =
-            sipl::math::abs(grays[i] - bg).clip(0, 255).as_type<uint8_t>();
-
-        // Threshold away low 10%
-        auto thresh_img = sipl::threshold_binary(diff, THRESH_VAL);
-        for (size_t p = 0; p < points.size(); ++p) {
-            slice_img(2 * i, p) = thresh_img(points[p][1], points[p][0]);
-            slice_img(2 * i + 1, p) = thresh_img(points[p][1], points[p][0]);
+    sipl::MatrixXb slice_img(nframes * 2, line.size());
+    for (int32_t i = 0; i < nframes; ++i) {
+
+        // Subtract background and threshold away low 10%
+        auto thresh =
+            sipl::threshold_difference(profiles[i], bg, THRESH_VAL);
+        for (int32_t p = 0; p < line.size(); ++p) {
+            slice_img(2 * i, p) = thresh[p];
+            slice_img(2 * i + 1, p) = thresh[p];
         }
     }
-    grays.reserve(0);
-    grays.shrink_to_fit();
+    profiles.clear();
+    profiles.shrink_to_fit();
 
     // Median blur
-    auto median_ksize = int32_t(0.02 * points.size());
+    auto median_ksize = int32_t(0.02 * line.size());
     if (median_ksize % 2 == 0) {
         median_ksize += 1;
     }
     slice_img = sipl::median_filter(slice_img, median_ksize, median_ksize);
 
     // Dilate by square
-    auto morph_ksize = int32_t(MORPH_KERNEL_SIZE_PERC * points.size());
+    auto morph_ksize = int32_t(MORPH_KERNEL_SIZE_PERC * line.size());
     slice_img = sipl::morphology::dilate(
         slice_img,
         sipl::morphology::kernels::rectangle(morph_ksize, morph_ksize));
@@ -141,98 +143,3 @@ void parse_commandline(char** argv)
     img_start = std::stoi(argv[6]);
     img_count = std::stoi(argv[7]);
 }
-
-std::vector<std::string> generate_filenames(const std::string& format,
-                                            int32_t start,
-                                            int32_t count)
-{
-    std::vector<std::string> filenames;
-    for (int32_t i = start; i <= count; ++i) {
-        // Code taken from: http://stackoverflow.com/a/26221725
-        // + 1 for null terminator
-        size_t size = std::snprintf(nullptr, 0, format.c_str(), i) + 1;
-        auto buf = std::make_unique<char[]>(size);
-        std::snprintf(buf.get(), size, format.c_str(), i);
-        filenames.emplace_back(buf.get(), buf.get() + size - 1);
-    }
-
-    return filenames;
-}
-
-std::vector<sipl::MatrixXb> read_video_dir(
-    const std::vector<std::string>& filenames)
-{
-    std::vector<sipl::MatrixXb> gray_pngs;
-    gray_pngs.reserve(filenames.size());
-    for (const auto& f : filenames) {
-        auto color = sipl::PngIO::read(f);
-        gray_pngs.push_back(color_to_grayscale(color));
-    }
-
-    return gray_pngs;
-}
-
-// Implementation taken from:
-// https://www.cs.unm.edu/~angel/BOOK/INTERACTIVE_COMPUTER_GRAPHICS/FOURTH_EDITION/PROGRAMS/bresenham.c
-std::vector<sipl::Vector2i> bresenham(const sipl::Vector2i& p1,
-                                      const sipl::Vector2i& p2)
-{
-    std::vector<sipl::Vector2i> points;
-    int32_t dx, dy, i, e;
-    int32_t incx, incy, inc1, inc2;
-    int32_t x, y;
-
-    dx = p2[0] - p1[0];
-    dy = p2[1] - p1[1];
-
-    if (dx < 0) {
-        dx = -dx;
-    }
-    if (dy < 0) {
-        dy = -dy;
-    }
-    incx = 1;
-    if (p2[0] < p1[0]) {
-        incx = -1;
-    }
-    incy = 1;
-    if (p2[1] < p1[1]) {
-        incy = -1;
-    }
-    x = p1[0];
-    y = p1[1];
-
-    if (dx > dy) {
-        points.push_back({x, y});
-        e = 2 * dy - dx;
-        inc1 = 2 * (dy - dx);
-        inc2 = 2 * dy;
-        for (i = 0; i < dx; i++) {
-            if (e >= 0) {
-                y += incy;
-                e += inc1;
-            } else {
-                e += inc2;
-            }
-            x += incx;
-            points.push_back({x, y});
-        }
-    } else {
-        points.push_back({x, y});
-        e = 2 * dx - dy;
-        inc1 = 2 * (dx - dy);
-        inc2 = 2 * dx;
-        for (i = 0; i < dy; i++) {
-            if (e >= 0) {
-                x += incx;
-                e += inc1;
-            } else {
-                e += inc2;
-            }
-            y += incy;
-            points.push_back({x, y});
-        }
-    }
-
-    return points;
-}
@@ -25,8 +25,7 @@ int main(int argc, char** argv)
     if (argc < 2) {
         std::cout << "Usage:" << std::endl;
         std::cout << "    " << argv[0] << " -i inputFileName -o outputFileName "
-                                          "[-c|{-p transformFileName N|B}]"
-                  << std::endl;
+                  << "[-c|{-p transformFileName N|B|C|L}]" << std::endl;
         std::exit(1);
     }
 
@@ -89,8 +88,45 @@ int main(int argc, char** argv)
             break;
         }
 
+        // Bicubic inteprolation
+        case InterpolateType::BICUBIC: {
+            if (ftype == FileType::PGM) {
+                auto img = PgmIO::read(g_infile);
+                auto new_mat =
+                    projective_transform<BicubicInterpolator<double>>(
+                        img, transform);
+                PgmIO::write(new_mat, g_outfile);
+            } else {
+                auto img = PpmIO::read(g_infile);
+                auto new_mat =
+                    projective_transform<BicubicInterpolator<Vector3d>>(
+                        img, transform);
+                PpmIO::write(new_mat, g_outfile);
+            }
+            break;
+        }
+
+        // Lanczos (3 lobes) inteprolation
+        case InterpolateType::LANCZOS: {
+            if (ftype == FileType::PGM) {
+                auto img = PgmIO::read(g_infile);
+                auto new_mat =
+                    projective_transform<LanczosInterpolator<double>>(
+                        img, transform);
+                PgmIO::write(new_mat, g_outfile);
+            } else {
+                auto img = PpmIO::read(g_infile);
+                auto new_mat =
+                    projective_transform<LanczosInterpolator<Vector3d>>(
+                        img, transform);
+                PpmIO::write(new_mat, g_outfile);
+            }
+            break;
+        }
+
         case InterpolateType::UNKNOWN:
-            std::cerr << "[error]: Unknown interpolate type. Use one of [N, B]"
+            std::cerr << "[error]: Unknown interpolate type. "
+                         "Use one of [N, B, C, L]"
                       << std::endl;
             std::exit(1);
         }
@@ -146,6 +182,10 @@ void parse_commandline(int32_t argc, char** argv)
                 g_interpolate_type = InterpolateType::NEAREST_NEIGHBOR;
             } else if (std::strncmp(argv[i], "B", 1) == 0) {
                 g_interpolate_type = InterpolateType::BILINEAR;
+            } else if (std::strncmp(argv[i], "C", 1) == 0) {
+                g_interpolate_type = InterpolateType::BICUBIC;
+            } else if (std::strncmp(argv[i], "L", 1) == 0) {
+                g_interpolate_type = InterpolateType::LANCZOS;
             } else {
                 g_interpolate_type = InterpolateType::UNKNOWN;
             }
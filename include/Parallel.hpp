@@ -0,0 +1,74 @@
+#pragma once
+
+#ifndef SIPL_PARALLEL_H
+#define SIPL_PARALLEL_H
+
+#include <algorithm>
+#include <cstdint>
+#include <exception>
+#include <thread>
+#include <vector>
+
+namespace sipl
+{
+
+// nthreads <= 0 means one thread per core
+inline int32_t resolve_threads(int32_t nthreads)
+{
+    if (nthreads > 0) {
+        return nthreads;
+    }
+    return std::max(1, int32_t(std::thread::hardware_concurrency()));
+}
+
+// Split [begin, end) into up to nthreads contiguous chunks of at least
+// min_chunk items and call f(chunk_begin, chunk_end) for each chunk on its own
+// thread. The calling thread runs the first chunk. If any chunk throws, the
+// first exception is rethrown once every thread has finished
+template <typename Function>
+void parallel_for(int32_t begin,
+                  int32_t end,
+                  Function f,
+                  int32_t nthreads = 0,
+                  int32_t min_chunk = 1)
+{
+    const int32_t n = end - begin;
+    if (n <= 0) {
+        return;
+    }
+    const int32_t nchunks = std::max(
+        1, std::min(resolve_threads(nthreads), n / std::max(min_chunk, 1)));
+    if (nchunks == 1) {
+        f(begin, end);
+        return;
+    }
+
+    std::vector<std::exception_ptr> errors(nchunks);
+    auto run_chunk = [&](int32_t c) {
+        const int32_t b = begin + int32_t(int64_t(n) * c / nchunks);
+        const int32_t e = begin + int32_t(int64_t(n) * (c + 1) / nchunks);
+        try {
+            f(b, e);
+        } catch (...) {
+            errors[size_t(c)] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    threads.reserve(size_t(nchunks - 1));
+    for (int32_t c = 1; c < nchunks; ++c) {
+        threads.emplace_back(run_chunk, c);
+    }
+    run_chunk(0);
+    for (auto& t : threads) {
+        t.join();
+    }
+    for (const auto& e : errors) {
+        if (e) {
+            std::rethrow_exception(e);
+        }
+    }
+}
+}
+
+#endif
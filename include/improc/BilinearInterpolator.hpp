@@ -4,11 +4,30 @@
 #define SIPL_IMPROC_BILINEARINTERPOLATOR_HPP
 
 #include "matrix/Matrix.hpp"
+#include "matrix/Vector.hpp"
 #include "Common.hpp"
 
 namespace sipl
 {
 
+namespace impl
+{
+
+// Round and saturate an interpolated value back to the pixel type
+template <typename Dtype>
+Dtype to_pixel(double value, Dtype*)
+{
+    return clamp<Dtype>(value);
+}
+
+template <typename T, int32_t Length>
+Vector<T, Length> to_pixel(const Vector<double, Length>& value,
+                           Vector<T, Length>*)
+{
+    return clamp<T>(value);
+}
+}
+
 template <typename InternalType>
 struct BilinearInterpolator {
     template <typename Dtype>
@@ -36,7 +55,7 @@ struct BilinearInterpolator {
         // Then linearly interpolate those values
         InternalType f = (y2 - y) * xy1 + (y - y1) * xy2;
 
-        return clamp<uint8_t>(f);
+        return impl::to_pixel(f, static_cast<Dtype*>(nullptr));
     }
 };
 }
@@ -0,0 +1,91 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_COLOR_H
+#define SIPL_IMPROC_COLOR_H
+
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <cstdint>
+
+namespace sipl
+{
+
+// 8-bit color space conversions, SSE2 where available (every planar kernel,
+// 16 pixels at a time). Gray, YCbCr and HSV to RGB use 16-bit fixed point;
+// RGB to HSV rounds its two divisions exactly. Results are within 1 LSB of
+// rounding the floating point formula.
+//
+// Gray:  Y = 0.299 R + 0.587 G + 0.114 B
+// YCbCr: full range JPEG/JFIF, Cb and Cr centered on 128
+// HSV:   H covers the whole hue circle in 0..255 (256 steps per 360
+//        degrees), S = 255 * (max - min) / max, V = max
+//
+// Planar kernels take each channel as its own buffer of n pixels; packed ones
+// take interleaved 3-byte pixels (RGB, YCbCr or HSV order).
+void rgb_to_gray(const uint8_t* r,
+                 const uint8_t* g,
+                 const uint8_t* b,
+                 uint8_t* gray,
+                 int32_t n);
+
+void rgb_to_ycbcr(const uint8_t* r,
+                  const uint8_t* g,
+                  const uint8_t* b,
+                  uint8_t* y,
+                  uint8_t* cb,
+                  uint8_t* cr,
+                  int32_t n);
+
+void ycbcr_to_rgb(const uint8_t* y,
+                  const uint8_t* cb,
+                  const uint8_t* cr,
+                  uint8_t* r,
+                  uint8_t* g,
+                  uint8_t* b,
+                  int32_t n);
+
+void rgb_to_hsv(const uint8_t* r,
+                const uint8_t* g,
+                const uint8_t* b,
+                uint8_t* h,
+                uint8_t* s,
+                uint8_t* v,
+                int32_t n);
+
+void hsv_to_rgb(const uint8_t* h,
+                const uint8_t* s,
+                const uint8_t* v,
+                uint8_t* r,
+                uint8_t* g,
+                uint8_t* b,
+                int32_t n);
+
+void rgb_to_gray_packed(const uint8_t* rgb, uint8_t* gray, int32_t n);
+
+void rgb_to_ycbcr_packed(const uint8_t* rgb, uint8_t* ycbcr, int32_t n);
+
+void ycbcr_to_rgb_packed(const uint8_t* ycbcr, uint8_t* rgb, int32_t n);
+
+void rgb_to_hsv_packed(const uint8_t* rgb, uint8_t* hsv, int32_t n);
+
+void hsv_to_rgb_packed(const uint8_t* hsv, uint8_t* rgb, int32_t n);
+
+// Whole-image conversions, split by rows across nthreads threads (<= 0: one
+// per core) for large images. YCbCr and HSV images are stored channel by
+// channel in RgbPixels
+MatrixXb rgb_to_gray(const MatrixX<RgbPixel>& img, int32_t nthreads = 0);
+
+MatrixX<RgbPixel> rgb_to_ycbcr(const MatrixX<RgbPixel>& img,
+                               int32_t nthreads = 0);
+
+MatrixX<RgbPixel> ycbcr_to_rgb(const MatrixX<RgbPixel>& img,
+                               int32_t nthreads = 0);
+
+MatrixX<RgbPixel> rgb_to_hsv(const MatrixX<RgbPixel>& img,
+                             int32_t nthreads = 0);
+
+MatrixX<RgbPixel> hsv_to_rgb(const MatrixX<RgbPixel>& img,
+                             int32_t nthreads = 0);
+}
+
+#endif
@@ -4,13 +4,18 @@
 #define SIPL_IMPROC_FILTER_H
 
 #include "Common.hpp"
+#include "improc/Color.hpp"
 #include "improc/Kernels.hpp"
+#include "improc/Lut.hpp"
+#include "improc/WindowHistogram.hpp"
 #include "io/BmpIO.hpp"
 #include "matrix/Matrix"
 #include "matrix/Vector"
 #include <algorithm>
+#include <cassert>
 #include <deque>
 #include <limits>
+#include <type_traits>
 
 namespace sipl
 {
@@ -83,15 +88,16 @@ MatrixX<Dtype> median_filter(const MatrixX<Dtype>& img,
     return nonlinear_kth_filter(img, height, width, (height + width) / 2);
 }
 
+namespace impl
+{
+
 template <typename Dtype>
 MatrixX<Dtype> nonlinear_kth_filter(const MatrixX<Dtype>& img,
                                     int32_t height,
                                     int32_t width,
-                                    int32_t k)
+                                    int32_t k,
+                                    std::false_type)
 {
-    assert(width % 2 == 1 && height % 2 == 1 && "width and height must be odd");
-    assert(k >= 0 && k < width * height && "k out of bounds");
-
     // For every pixel in the image, get a patch of size height x width around
     // it, sort it, then take the kth element and make that the element we use
     // for the output matrix
@@ -107,6 +113,30 @@ MatrixX<Dtype> nonlinear_kth_filter(const MatrixX<Dtype>& img,
     return result;
 }
 
+// 8-bit images don't need the sort: a sliding window histogram answers the
+// same query
+inline MatrixXb nonlinear_kth_filter(const MatrixXb& img,
+                                     int32_t height,
+                                     int32_t width,
+                                     int32_t k,
+                                     std::true_type)
+{
+    return rank_filter(img, height, width, k);
+}
+}
+
+template <typename Dtype>
+MatrixX<Dtype> nonlinear_kth_filter(const MatrixX<Dtype>& img,
+                                    int32_t height,
+                                    int32_t width,
+                                    int32_t k)
+{
+    assert(width % 2 == 1 && height % 2 == 1 && "width and height must be odd");
+    assert(k >= 0 && k < width * height && "k out of bounds");
+    return impl::nonlinear_kth_filter(img, height, width, k,
+                                      std::is_same<Dtype, uint8_t>());
+}
+
 // Thresholds of different types
 enum class ThresholdType {
     KEEP_ABOVE,
@@ -123,39 +153,27 @@ MatrixX<OutputType> threshold(
     OutputType lower = std::numeric_limits<OutputType>::min(),
     OutputType upper = std::numeric_limits<OutputType>::max())
 {
-    MatrixX<OutputType> result(img.dims, 0);
     switch (type) {
     case ThresholdType::KEEP_ABOVE:
-        for (int32_t i = 0; i < img.dims[0]; ++i) {
-            for (int32_t j = 0; j < img.dims[1]; ++j) {
-                result(i, j) = img(i, j) > thresh ? img(i, j) : lower;
-            }
-        }
-        break;
+        return map_pixels<OutputType>(img, [thresh, lower](InputType v) {
+            return v > thresh ? v : lower;
+        });
     case ThresholdType::KEEP_ABOVE_EQ:
-        for (int32_t i = 0; i < img.dims[0]; ++i) {
-            for (int32_t j = 0; j < img.dims[1]; ++j) {
-                result(i, j) = img(i, j) >= thresh ? img(i, j) : lower;
-            }
-        }
-        break;
+        return map_pixels<OutputType>(img, [thresh, lower](InputType v) {
+            return v >= thresh ? v : lower;
+        });
     case ThresholdType::KEEP_BELOW:
-        for (int32_t i = 0; i < img.dims[0]; ++i) {
-            for (int32_t j = 0; j < img.dims[1]; ++j) {
-                result(i, j) = img(i, j) < thresh ? img(i, j) : upper;
-            }
-        }
-        break;
+        return map_pixels<OutputType>(img, [thresh, upper](InputType v) {
+            return v < thresh ? v : upper;
+        });
     case ThresholdType::KEEP_BELOW_EQ:
-        for (int32_t i = 0; i < img.dims[0]; ++i) {
-            for (int32_t j = 0; j < img.dims[1]; ++j) {
-                result(i, j) = img(i, j) <= thresh ? img(i, j) : upper;
-            }
-        }
         break;
     }
 
-    return result;
+    assert(type == ThresholdType::KEEP_BELOW_EQ && "unknown threshold type");
+    return map_pixels<OutputType>(img, [thresh, upper](InputType v) {
+        return v <= thresh ? v : upper;
+    });
 }
 
 template <typename Dtype>
@@ -169,9 +187,30 @@ MatrixX<Dtype> threshold_binary(const MatrixX<Dtype>& img, Dtype threshold)
             "threshold must be between min and max for Dtype");
     }
 
+    return map_pixels<Dtype>(img, [threshold, min, max](Dtype v) {
+        return v >= threshold ? max : min;
+    });
+}
+
+// Background subtraction followed by a binary threshold. Same result as
+// threshold_binary(math::abs(img - background).clip(min, max).as_type<Dtype>(),
+// threshold) without materializing the intermediate double matrices
+template <typename Dtype>
+MatrixX<Dtype> threshold_difference(const MatrixX<Dtype>& img,
+                                    const MatrixXd& background,
+                                    Dtype threshold)
+{
+    assert(img.dims == background.dims && "size mismatch");
+    const auto min = std::numeric_limits<Dtype>::min();
+    const auto max = std::numeric_limits<Dtype>::max();
+
     MatrixX<Dtype> thresh(img.dims);
     for (int32_t i = 0; i < img.size(); ++i) {
-        thresh[i] = (img[i] >= threshold ? max : min);
+        const double diff =
+            std::round(std::abs(double(img[i]) - background[i]));
+        const auto d =
+            Dtype(std::min(std::max(diff, double(min)), double(max)));
+        thresh[i] = (d >= threshold ? max : min);
     }
     return thresh;
 }
@@ -314,15 +353,10 @@ MatrixX<Dtype> canny(
     return linked;
 }
 
-// Convert a color image to grayscale
-MatrixXb color_to_grayscale(const MatrixX<RgbPixel>& color)
+// Convert a color image to grayscale (0.299 R + 0.587 G + 0.114 B)
+inline MatrixXb color_to_grayscale(const MatrixX<RgbPixel>& color)
 {
-    static Vector3d coeffs{0.299, 0.587, 0.114};
-    MatrixXb grayscale(color.dims);
-    for (int32_t i = 0; i < color.size(); ++i) {
-        grayscale[i] = clamp<uint8_t>(color[i].dot(coeffs));
-    }
-    return grayscale;
+    return rgb_to_gray(color);
 }
 }
 
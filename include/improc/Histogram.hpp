@@ -3,34 +3,129 @@
 #ifndef SIPL_IMPROC_HISTOGRAM_HPP
 #define SIPL_IMPROC_HISTOGRAM_HPP
 
-#include <limits>
+#include <algorithm>
+#include <array>
+#include <cassert>
 #include <cstdlib>
+#include <limits>
+#include <mutex>
+#include <type_traits>
+#include <vector>
+#include "Parallel.hpp"
 #include "Common.hpp"
 #include "matrix/Matrix"
 #include "matrix/Vector"
+#include "improc/Lut.hpp"
 #include "improc/Transform.hpp"
 
 namespace sipl
 {
 
-// Calculate histogram of mat
-template <typename Dtype>
-VectorX<uint32_t> histogram(const MatrixX<Dtype>& mat)
+// Equal-width bins covering [min, max]. The last bin includes max; values
+// outside the range (and NaNs) aren't counted
+struct HistogramBins {
+    int32_t nbins;
+    double min;
+    double max;
+};
+
+namespace impl
 {
-    const int32_t max = std::numeric_limits<Dtype>::max();
-    VectorX<uint32_t> hist(max + 1, 0);
-    for (const auto e : mat) {
-        hist[e]++;
-    }
+
+// Counts bin_of(data[i]) into a shared histogram of nbins bins. Counts go into
+// interleaved sub-histograms first so runs of equal pixels don't serialize on
+// a single counter, and each thread merges its own partial counts at the end.
+// bin_of returns nbins for values that shouldn't be counted
+template <typename Dtype, typename BinOf>
+VectorX<uint32_t> count_bins(const MatrixX<Dtype>& mat,
+                             int32_t nbins,
+                             BinOf bin_of,
+                             int32_t nthreads)
+{
+    constexpr int32_t MIN_CHUNK = 1 << 16;
+    constexpr int32_t MAX_INTERLEAVED_BINS = 4096;
+
+    VectorX<uint32_t> hist(nbins, 0);
+    std::mutex hist_mutex;
+    const Dtype* data = mat.data();
+    parallel_for(
+        0, mat.size(),
+        [&](int32_t begin, int32_t end) {
+            const int32_t ways = (nbins <= MAX_INTERLEAVED_BINS ? 4 : 1);
+            const int32_t stride = nbins + 1;
+            std::vector<uint32_t> sub(size_t(stride) * size_t(ways), 0);
+
+            int32_t i = begin;
+            if (ways == 4) {
+                uint32_t* h0 = sub.data();
+                uint32_t* h1 = h0 + stride;
+                uint32_t* h2 = h1 + stride;
+                uint32_t* h3 = h2 + stride;
+                for (; i + 4 <= end; i += 4) {
+                    h0[bin_of(data[i])]++;
+                    h1[bin_of(data[i + 1])]++;
+                    h2[bin_of(data[i + 2])]++;
+                    h3[bin_of(data[i + 3])]++;
+                }
+            }
+            for (; i < end; ++i) {
+                sub[size_t(bin_of(data[i]))]++;
+            }
+
+            std::lock_guard<std::mutex> lock(hist_mutex);
+            for (int32_t w = 0; w < ways; ++w) {
+                const uint32_t* h = &sub[size_t(w) * size_t(stride)];
+                for (int32_t b = 0; b < nbins; ++b) {
+                    hist[b] += h[b];
+                }
+            }
+        },
+        nthreads, MIN_CHUNK);
+
     return hist;
 }
+}
 
-// Calculate histogram cdf
+// Calculate histogram of mat, one bin per possible value. For 8- and 16-bit
+// types. Large images are split across nthreads threads (<= 0: one per core)
 template <typename Dtype>
-VectorX<uint32_t> histogram_cdf(const MatrixX<Dtype>& mat)
+VectorX<uint32_t> histogram(const MatrixX<Dtype>& mat, int32_t nthreads = 0)
 {
-    const auto hist = histogram(mat);
+    static_assert(std::is_integral<Dtype>::value && sizeof(Dtype) <= 2,
+                  "use a HistogramBins overload for wider or float types");
+    constexpr int32_t min = std::numeric_limits<Dtype>::min();
+    constexpr int32_t max = std::numeric_limits<Dtype>::max();
+    return impl::count_bins(mat, max - min + 1,
+                            [](Dtype e) { return int32_t(e) - min; },
+                            nthreads);
+}
 
+// Calculate histogram of mat over the given bins, for any scalar type
+template <typename Dtype>
+VectorX<uint32_t> histogram(const MatrixX<Dtype>& mat,
+                            const HistogramBins& bins,
+                            int32_t nthreads = 0)
+{
+    assert(bins.nbins > 0 && bins.max > bins.min && "invalid bins");
+    const int32_t nbins = bins.nbins;
+    const double min = bins.min;
+    const double max = bins.max;
+    const double scale = nbins / (max - min);
+    return impl::count_bins(mat, nbins,
+                            [nbins, min, max, scale](Dtype e) {
+                                const double v = double(e);
+                                if (!(v >= min && v <= max)) {
+                                    return nbins;
+                                }
+                                return std::min(int32_t((v - min) * scale),
+                                                nbins - 1);
+                            },
+                            nthreads);
+}
+
+// Calculate the cdf of an existing histogram
+inline VectorX<uint32_t> histogram_cdf(const VectorX<uint32_t>& hist)
+{
     uint32_t sum = 0;
     VectorX<uint32_t> cdf_hist(hist.size(), 0);
     for (int32_t i = 0; i < cdf_hist.size(); ++i) {
@@ -41,6 +136,13 @@ VectorX<uint32_t> histogram_cdf(const MatrixX<Dtype>& mat)
     return cdf_hist;
 }
 
+// Calculate histogram cdf
+template <typename Dtype>
+VectorX<uint32_t> histogram_cdf(const MatrixX<Dtype>& mat)
+{
+    return histogram_cdf(histogram(mat));
+}
+
 template <typename Dtype>
 MatrixX<Dtype> equalize_hist(const MatrixX<Dtype>& mat)
 {
@@ -69,54 +171,278 @@ MatrixX<Dtype> equalize_hist(const MatrixX<Dtype>& mat)
     }
 
     // 2. Compute the new equalized histogram image via lookup
-    MatrixX<uint8_t> equalized_hist_img(mat.dims);
-    for (int32_t i = 0; i < mat.size(); ++i) {
-        equalized_hist_img[i] = uint8_t(equalized_hist[mat[i]]);
+    return map_pixels<uint8_t>(
+        mat, [&equalized_hist](Dtype v) { return equalized_hist[v]; });
+}
+
+namespace impl
+{
+
+// Where a row (or column) sits between the centers of the two nearest tiles
+// along one axis: tiles t0 and t1 with t1's weight in 1/256ths
+struct TileBlend {
+    int32_t t0;
+    int32_t t1;
+    int32_t w1;
+};
+
+inline std::vector<TileBlend> tile_blends(int32_t size, int32_t ntiles)
+{
+    std::vector<double> centers(ntiles);
+    for (int32_t t = 0; t < ntiles; ++t) {
+        const int32_t begin = int32_t(int64_t(t) * size / ntiles);
+        const int32_t end = int32_t(int64_t(t + 1) * size / ntiles);
+        centers[size_t(t)] = (begin + end - 1) / 2.0;
     }
 
-    return equalized_hist_img;
+    std::vector<TileBlend> blends(size);
+    int32_t t = 0;
+    for (int32_t i = 0; i < size; ++i) {
+        while (t + 1 < ntiles && centers[size_t(t + 1)] <= i) {
+            ++t;
+        }
+        if (i <= centers[0] || t + 1 == ntiles) {
+            blends[size_t(i)] = {t, t, 0};
+        } else {
+            const double w = (i - centers[size_t(t)]) /
+                             (centers[size_t(t + 1)] - centers[size_t(t)]);
+            blends[size_t(i)] = {t, t + 1, int32_t(std::lround(w * 256))};
+        }
+    }
+    return blends;
+}
 }
 
-// Histogram match - return a new matrix (doesn't modify old image)
-template <typename Dtype>
-MatrixX<Dtype> histogram_match(const MatrixX<Dtype>& target,
-                               const MatrixX<Dtype>& source)
+// Contrast limited adaptive histogram equalization. The image is split into
+// tiles_y x tiles_x tiles, each equalized with its own histogram clipped at
+// clip_limit times the average bin count (the excess is spread back over all
+// bins; clip_limit <= 0 disables clipping). Every pixel then blends the LUTs
+// of the four nearest tiles bilinearly, with 1/256 weights. Tiles and rows
+// are spread across nthreads threads (<= 0: one per core)
+inline MatrixXb clahe(const MatrixXb& img,
+                      double clip_limit = 2.0,
+                      int32_t tiles_y = 8,
+                      int32_t tiles_x = 8,
+                      int32_t nthreads = 0)
+{
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    tiles_y = std::max(1, std::min(tiles_y, rows));
+    tiles_x = std::max(1, std::min(tiles_x, cols));
+
+    // 1. Clipped, equalized LUT for every tile
+    std::vector<LookupTable> luts(tiles_y * tiles_x);
+    parallel_for(
+        0, tiles_y * tiles_x,
+        [&](int32_t tile_begin, int32_t tile_end) {
+            std::array<int32_t, 256> hist;
+            for (int32_t t = tile_begin; t < tile_end; ++t) {
+                const int32_t ty = t / tiles_x, tx = t % tiles_x;
+                const int32_t y0 = int32_t(int64_t(ty) * rows / tiles_y);
+                const int32_t y1 = int32_t(int64_t(ty + 1) * rows / tiles_y);
+                const int32_t x0 = int32_t(int64_t(tx) * cols / tiles_x);
+                const int32_t x1 = int32_t(int64_t(tx + 1) * cols / tiles_x);
+                const int32_t area = (y1 - y0) * (x1 - x0);
+
+                hist.fill(0);
+                for (int32_t y = y0; y < y1; ++y) {
+                    const uint8_t* row = img.data() + y * cols;
+                    for (int32_t x = x0; x < x1; ++x) {
+                        hist[row[x]]++;
+                    }
+                }
+
+                if (clip_limit > 0) {
+                    const int32_t limit =
+                        std::max(int32_t(clip_limit * area / 256), 1);
+                    int32_t clipped = 0;
+                    for (auto& h : hist) {
+                        if (h > limit) {
+                            clipped += h - limit;
+                            h = limit;
+                        }
+                    }
+                    const int32_t redist = clipped / 256;
+                    int32_t residual = clipped - redist * 256;
+                    for (auto& h : hist) {
+                        h += redist;
+                    }
+                    if (residual > 0) {
+                        const int32_t step = std::max(256 / residual, 1);
+                        for (int32_t i = 0; i < 256 && residual > 0;
+                             i += step, --residual) {
+                            hist[size_t(i)]++;
+                        }
+                    }
+                }
+
+                auto& lut = luts[size_t(t)];
+                const double scale = 255.0 / area;
+                int32_t sum = 0;
+                for (size_t i = 0; i < 256; ++i) {
+                    sum += hist[i];
+                    lut[i] = clamp<uint8_t>(sum * scale);
+                }
+            }
+        },
+        nthreads);
+
+    // 2. Blend the four surrounding tiles' LUTs at each pixel. Each row
+    // first blends its two rows of tile LUTs vertically, all 256 entries at
+    // once, so a pixel only looks up two entries and blends horizontally
+    const auto row_blends = impl::tile_blends(rows, tiles_y);
+    const auto col_blends = impl::tile_blends(cols, tiles_x);
+    MatrixXb out(img.dims);
+    parallel_for(
+        0, rows,
+        [&](int32_t row_begin, int32_t row_end) {
+            std::vector<int16_t> blended(static_cast<size_t>(tiles_x * 256));
+            for (int32_t y = row_begin; y < row_end; ++y) {
+                const auto& rb = row_blends[size_t(y)];
+                impl::blend_luts(&luts[size_t(rb.t0 * tiles_x)],
+                                 &luts[size_t(rb.t1 * tiles_x)], tiles_x,
+                                 rb.w1, blended.data());
+                const uint8_t* in = img.data() + y * cols;
+                uint8_t* dst = out.data() + y * cols;
+                for (int32_t x = 0; x < cols; ++x) {
+                    const auto& cb = col_blends[size_t(x)];
+                    const int32_t left = blended[size_t(cb.t0 * 256 + in[x])];
+                    const int32_t right = blended[size_t(cb.t1 * 256 + in[x])];
+                    dst[x] = uint8_t(
+                        (left * (256 - cb.w1) + right * cb.w1 + (1 << 14)) >>
+                        15);
+                }
+            }
+        },
+        nthreads, 16);
+
+    return out;
+}
+
+namespace impl
 {
-    // Calculate CDF for both images
-    const auto target_cdf = histogram_cdf(target);
-    const auto source_cdf = histogram_cdf(source);
-    const auto target_cdf_norm =
-        target_cdf / double(target_cdf[target_cdf.size() - 1]);
-    const auto source_cdf_norm =
-        source_cdf / double(source_cdf[source_cdf.size() - 1]);
-
-    // Build lookup table for matching histograms
-    // Note: due to grading requirements of picking the lowest intensity gray
-    // level for instances of multimapped values from source CDF to target CDF,
-    // iterate backwards so we pick the earlier gray level and use <= min_diff
-    constexpr int32_t max = int32_t(std::numeric_limits<uint8_t>::max() + 1);
-    VectorX<Dtype> lut(max, 0);
-    for (int32_t j = 0; j < lut.size(); ++j) {
-        int32_t min_diff = std::numeric_limits<int32_t>::max();
-        for (int32_t i = target_cdf.size() - 1; i >= 0; --i) {
-            const int32_t res = std::abs(int32_t(
-                std::round((target_cdf_norm[i] - source_cdf_norm[j]) * max)));
-            if (res <= min_diff) {
-                min_diff = res;
-                lut[j] = Dtype(i);
+
+// For each source level j, the target level i minimizing
+// |round((target[i] - source[j]) * 256)|, lowest i on ties. Both CDFs are
+// nondecreasing, so the first target level at or above source[j] only moves
+// forward as j does; the nearest level is either there or in the run of equal
+// differences just before it (found by binary search). O(L) for typical
+// histograms instead of the O(L^2) all-pairs search
+inline std::vector<int32_t> match_cdfs(const VectorX<double>& target_cdf,
+                                       const VectorX<double>& source_cdf)
+{
+    constexpr double scale = std::numeric_limits<uint8_t>::max() + 1;
+    const int32_t nt = target_cdf.size();
+    std::vector<int32_t> lut(size_t(source_cdf.size()));
+    int32_t k = 0;
+    for (int32_t j = 0; j < source_cdf.size(); ++j) {
+        const double s = source_cdf[j];
+        auto diff = [&target_cdf, s](int32_t i) {
+            return int32_t(std::round((target_cdf[i] - s) * scale));
+        };
+
+        while (k < nt && diff(k) < 0) {
+            ++k;
+        }
+        if (k == 0) {
+            lut[size_t(j)] = 0;
+            continue;
+        }
+
+        const int32_t below = diff(k - 1);
+        if (k < nt && diff(k) < -below) {
+            lut[size_t(j)] = k;
+            continue;
+        }
+
+        // First level whose difference equals below
+        int32_t lo = 0, hi = k - 1;
+        while (lo < hi) {
+            const int32_t mid = (lo + hi) / 2;
+            if (diff(mid) < below) {
+                lo = mid + 1;
+            } else {
+                hi = mid;
             }
         }
+        lut[size_t(j)] = lo;
     }
+    return lut;
+}
 
-    // Alter the histogram of the source image to match target image via the LUT
-    MatrixX<Dtype> modified_source(source.dims);
-    for (int32_t i = 0; i < source.dims[0]; ++i) {
-        for (int32_t j = 0; j < source.dims[1]; ++j) {
-            modified_source(i, j) = lut[source(i, j)];
+inline VectorX<double> normalized_cdf(const VectorX<uint32_t>& hist)
+{
+    const auto cdf = histogram_cdf(hist);
+    return cdf / double(cdf[cdf.size() - 1]);
+}
+
+template <typename Dtype>
+VectorX<double> normalized_cdf(const MatrixX<Dtype>& mat)
+{
+    return normalized_cdf(histogram(mat));
+}
+}
+
+// Histogram and normalized CDF of an 8-bit image, computed once. Useful as a
+// fixed histogram_match target, e.g. matching every frame of a video to one
+// reference frame
+class HistogramModel
+{
+public:
+    explicit HistogramModel(const MatrixXb& img)
+        : hist_(sipl::histogram(img)), cdf_(impl::normalized_cdf(hist_))
+    {
+    }
+
+    const VectorX<uint32_t>& histogram() const { return hist_; }
+
+    const VectorX<double>& cdf() const { return cdf_; }
+
+    // Table mapping source's gray levels onto this histogram
+    LookupTable match_lut(const HistogramModel& source) const
+    {
+        return to_lut(impl::match_cdfs(cdf_, source.cdf_));
+    }
+
+    LookupTable match_lut(const MatrixXb& source) const
+    {
+        return to_lut(impl::match_cdfs(cdf_, impl::normalized_cdf(source)));
+    }
+
+    // Same as histogram_match(<this model's image>, source)
+    MatrixXb match(const MatrixXb& source, int32_t nthreads = 0) const
+    {
+        return lut_apply(source, match_lut(source), nthreads);
+    }
+
+private:
+    VectorX<uint32_t> hist_;
+    VectorX<double> cdf_;
+
+    static LookupTable to_lut(const std::vector<int32_t>& levels)
+    {
+        LookupTable lut;
+        for (size_t i = 0; i < lut.size(); ++i) {
+            lut[i] = uint8_t(levels[i]);
         }
+        return lut;
     }
+};
 
-    return modified_source;
+// Histogram match - return a new matrix (doesn't modify old image)
+// Note: due to grading requirements of picking the lowest intensity gray level
+// for instances of multimapped values from source CDF to target CDF, ties go to
+// the earlier gray level
+template <typename Dtype>
+MatrixX<Dtype> histogram_match(const MatrixX<Dtype>& target,
+                               const MatrixX<Dtype>& source)
+{
+    const auto levels = impl::match_cdfs(impl::normalized_cdf(target),
+                                         impl::normalized_cdf(source));
+
+    // Alter the histogram of the source image to match target image via the LUT
+    return map_pixels<Dtype>(
+        source, [&levels](Dtype v) { return Dtype(levels[size_t(v)]); });
 }
 
 // Convert incoming histogram to an actual image
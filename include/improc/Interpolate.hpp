@@ -0,0 +1,88 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_INTERPOLATE_H
+#define SIPL_IMPROC_INTERPOLATE_H
+
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <cstdint>
+
+namespace sipl
+{
+
+// Bilinear interpolation of img at n source positions (xs[k], ys[k]) into
+// out[k]. Bounds are the same as BilinearInterpolator's: positions whose four
+// neighbors aren't all inside img get fill_value.
+//
+// Integer pixels blend with fixed-point weights (1/256ths for 8-bit,
+// 1/65536ths for 16-bit) and come out within 1 level of the double formula.
+// Runs of 8 positions that are all inside the image go through a branch-free
+// SSE2 kernel (8-bit gray and RGB); the rest take a per-pixel border path
+// that computes the same values
+void bilinear_span(const MatrixXb& img,
+                   const double* xs,
+                   const double* ys,
+                   int32_t n,
+                   uint8_t* out,
+                   uint8_t fill_value);
+
+void bilinear_span(const MatrixX<RgbPixel>& img,
+                   const double* xs,
+                   const double* ys,
+                   int32_t n,
+                   RgbPixel* out,
+                   const RgbPixel& fill_value);
+
+void bilinear_span(const MatrixX<uint16_t>& img,
+                   const double* xs,
+                   const double* ys,
+                   int32_t n,
+                   uint16_t* out,
+                   uint16_t fill_value);
+
+void bilinear_span(const MatrixX<float>& img,
+                   const double* xs,
+                   const double* ys,
+                   int32_t n,
+                   float* out,
+                   float fill_value);
+
+namespace impl
+{
+
+// Positions handled by one pass of blend_block
+constexpr int32_t SPAN_BLOCK = 8;
+
+// The four neighbors of SPAN_BLOCK positions, widened to 16 bits
+struct Corners {
+    alignas(16) int16_t p00[SPAN_BLOCK];
+    alignas(16) int16_t p01[SPAN_BLOCK];
+    alignas(16) int16_t p10[SPAN_BLOCK];
+    alignas(16) int16_t p11[SPAN_BLOCK];
+};
+
+// One 8-bit channel of a bilinear blend with weights in 1/256ths. The
+// horizontal sums are halved so they fit in 16 bits for pmaddwd;
+// blend_block computes exactly this
+inline uint8_t blend_q8(int32_t p00,
+                        int32_t p01,
+                        int32_t p10,
+                        int32_t p11,
+                        int32_t wx,
+                        int32_t wy)
+{
+    const int32_t top = (p00 * (256 - wx) + p01 * wx + 1) >> 1;
+    const int32_t bottom = (p10 * (256 - wx) + p11 * wx + 1) >> 1;
+    return uint8_t((top * (256 - wy) + bottom * wy + (1 << 14)) >> 15);
+}
+
+// blend_q8 on SPAN_BLOCK positions at once (SSE2 where available). wx and wy
+// are 16-byte aligned
+void blend_block(const Corners& c,
+                 const int16_t* wx,
+                 const int16_t* wy,
+                 uint8_t* out);
+}
+}
+
+#endif
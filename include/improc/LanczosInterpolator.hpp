@@ -0,0 +1,47 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_LANCZOSINTERPOLATOR_HPP
+#define SIPL_IMPROC_LANCZOSINTERPOLATOR_HPP
+
+#include "Common.hpp"
+#include "improc/SeparableInterpolator.hpp"
+#include "matrix/Matrix.hpp"
+#include <cmath>
+
+namespace sipl
+{
+
+namespace impl
+{
+
+// sinc(x) * sinc(x / 3) on (-3, 3)
+inline double lanczos3(double x)
+{
+    if (x == 0) {
+        return 1;
+    } else if (std::abs(x) >= 3) {
+        return 0;
+    }
+    const double px = M_PI * x;
+    return 3 * std::sin(px) * std::sin(px / 3) / (px * px);
+}
+}
+
+// 6 x 6 Lanczos (3 lobes). The sharpest of the interpolators, with slight
+// ringing at hard edges
+template <typename InternalType>
+struct LanczosInterpolator {
+    template <typename Dtype>
+    Dtype operator()(const MatrixX<Dtype>& img,
+                     double x,
+                     double y,
+                     Dtype fill_value = Dtype(0))
+    {
+        static const impl::PhaseTable<6> table(impl::lanczos3);
+        return impl::separable_sample<InternalType>(table, img, x, y,
+                                                    fill_value);
+    }
+};
+}
+
+#endif
@@ -0,0 +1,140 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_LINEPROFILE_H
+#define SIPL_IMPROC_LINEPROFILE_H
+
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <algorithm>
+#include <cassert>
+#include <vector>
+
+namespace sipl
+{
+
+// Pixel coordinates ({x, y}) on the line from p1 to p2, both ends included.
+// Implementation taken from:
+// https://www.cs.unm.edu/~angel/BOOK/INTERACTIVE_COMPUTER_GRAPHICS/FOURTH_EDITION/PROGRAMS/bresenham.c
+inline std::vector<Vector2i> bresenham(const Vector2i& p1, const Vector2i& p2)
+{
+    std::vector<Vector2i> points;
+    int32_t dx, dy, i, e;
+    int32_t incx, incy, inc1, inc2;
+    int32_t x, y;
+
+    dx = p2[0] - p1[0];
+    dy = p2[1] - p1[1];
+
+    if (dx < 0) {
+        dx = -dx;
+    }
+    if (dy < 0) {
+        dy = -dy;
+    }
+    incx = 1;
+    if (p2[0] < p1[0]) {
+        incx = -1;
+    }
+    incy = 1;
+    if (p2[1] < p1[1]) {
+        incy = -1;
+    }
+    x = p1[0];
+    y = p1[1];
+
+    points.reserve(size_t(std::max(dx, dy) + 1));
+    if (dx > dy) {
+        points.push_back({x, y});
+        e = 2 * dy - dx;
+        inc1 = 2 * (dy - dx);
+        inc2 = 2 * dy;
+        for (i = 0; i < dx; i++) {
+            if (e >= 0) {
+                y += incy;
+                e += inc1;
+            } else {
+                e += inc2;
+            }
+            x += incx;
+            points.push_back({x, y});
+        }
+    } else {
+        points.push_back({x, y});
+        e = 2 * dx - dy;
+        inc1 = 2 * (dx - dy);
+        inc2 = 2 * dx;
+        for (i = 0; i < dy; i++) {
+            if (e >= 0) {
+                x += incx;
+                e += inc1;
+            } else {
+                e += inc2;
+            }
+            y += incy;
+            points.push_back({x, y});
+        }
+    }
+
+    return points;
+}
+
+// The pixels under a line or polyline of interest. The coordinates are
+// rasterized once up front; per frame only those pixels are touched, so
+// sampling costs O(line length) rather than O(width * height). Samples come
+// out as a 1 x size() row, which the usual matrix ops (and
+// threshold_difference, BackgroundModel, ...) work on directly
+class LineProfile
+{
+public:
+    LineProfile(const Vector2i& p1, const Vector2i& p2)
+        : points_(bresenham(p1, p2))
+    {
+    }
+
+    // Polyline through vertices. Each interior vertex is sampled once
+    explicit LineProfile(const std::vector<Vector2i>& vertices)
+    {
+        assert(!vertices.empty() && "polyline needs at least one vertex");
+        points_.push_back(vertices[0]);
+        for (size_t v = 1; v < vertices.size(); ++v) {
+            auto segment = bresenham(vertices[v - 1], vertices[v]);
+            points_.insert(std::end(points_), std::begin(segment) + 1,
+                           std::end(segment));
+        }
+    }
+
+    int32_t size() const { return int32_t(points_.size()); }
+
+    const std::vector<Vector2i>& points() const { return points_; }
+
+    // Gather the pixels of img under the line into out, which is only
+    // reallocated if it isn't already 1 x size()
+    template <typename Dtype>
+    void sample(const MatrixX<Dtype>& img, MatrixX<Dtype>& out) const
+    {
+        if (out.dims[0] != 1 || out.dims[1] != size()) {
+            out = MatrixX<Dtype>(1, size());
+        }
+        const int32_t cols = img.dims[1];
+        for (int32_t p = 0; p < size(); ++p) {
+            const auto& pt = points_[size_t(p)];
+            assert(pt[0] >= 0 && pt[0] < cols && pt[1] >= 0 &&
+                   pt[1] < img.dims[0] && "line point outside image");
+            out[p] = img[pt[1] * cols + pt[0]];
+        }
+    }
+
+    template <typename Dtype>
+    MatrixX<Dtype> sample(const MatrixX<Dtype>& img) const
+    {
+        MatrixX<Dtype> out(1, size());
+        sample(img, out);
+        return out;
+    }
+
+private:
+    std::vector<Vector2i> points_;
+};
+}
+
+#endif
@@ -0,0 +1,122 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_LUT_H
+#define SIPL_IMPROC_LUT_H
+
+#include "Parallel.hpp"
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <array>
+#include <cstdint>
+#include <type_traits>
+
+namespace sipl
+{
+
+// 256-entry lookup table mapping 8-bit values to 8-bit values
+using LookupTable = std::array<uint8_t, 256>;
+
+// Tabulate any uint8_t -> uint8_t function
+template <typename Function>
+LookupTable make_lut(Function f)
+{
+    LookupTable table;
+    for (int32_t i = 0; i < 256; ++i) {
+        table[size_t(i)] = uint8_t(f(uint8_t(i)));
+    }
+    return table;
+}
+
+// out[i] = table[in[i]] for n values. in and out may be the same buffer
+void lut_apply(const uint8_t* in,
+               uint8_t* out,
+               int32_t n,
+               const LookupTable& table);
+
+// Split across nthreads threads (<= 0: one per core) for large images
+MatrixXb lut_apply(const MatrixXb& img,
+                   const LookupTable& table,
+                   int32_t nthreads = 0);
+
+// Multi-channel images: channel c goes through tables[c]
+template <int32_t Length>
+MatrixX<Vector<uint8_t, Length>> lut_apply(
+    const MatrixX<Vector<uint8_t, Length>>& img,
+    const std::array<LookupTable, size_t(Length)>& tables,
+    int32_t nthreads = 0)
+{
+    constexpr int32_t MIN_CHUNK = 1 << 16;
+    MatrixX<Vector<uint8_t, Length>> out(img.dims);
+    parallel_for(0, img.size(),
+                 [&](int32_t begin, int32_t end) {
+                     for (int32_t i = begin; i < end; ++i) {
+                         for (int32_t c = 0; c < Length; ++c) {
+                             out[i][c] = tables[size_t(c)][img[i][c]];
+                         }
+                     }
+                 },
+                 nthreads, MIN_CHUNK);
+    return out;
+}
+
+// Multi-channel images with the same table for every channel
+template <int32_t Length>
+MatrixX<Vector<uint8_t, Length>> lut_apply(
+    const MatrixX<Vector<uint8_t, Length>>& img,
+    const LookupTable& table,
+    int32_t nthreads = 0)
+{
+    std::array<LookupTable, size_t(Length)> tables;
+    tables.fill(table);
+    return lut_apply(img, tables, nthreads);
+}
+
+namespace impl
+{
+
+// Blend n pairs of tables with weight w (1/256ths) on the second table:
+// out[t * 256 + v] = (a[t][v] * (256 - w) + b[t][v] * w + 1) >> 1. The halving
+// keeps entries within 15 bits, so they can be blended again with 1/256
+// weights in 32-bit arithmetic. SSE2 where available, 16 entries at a time
+void blend_luts(const LookupTable* a,
+                const LookupTable* b,
+                int32_t n,
+                int32_t w,
+                int16_t* out);
+
+template <typename OutputType, typename InputType, typename Function>
+MatrixX<OutputType> map_pixels(const MatrixX<InputType>& img,
+                               Function f,
+                               std::false_type)
+{
+    MatrixX<OutputType> out(img.dims);
+    for (int32_t i = 0; i < img.size(); ++i) {
+        out[i] = OutputType(f(img[i]));
+    }
+    return out;
+}
+
+template <typename OutputType, typename InputType, typename Function>
+MatrixX<OutputType> map_pixels(const MatrixX<InputType>& img,
+                               Function f,
+                               std::true_type)
+{
+    return lut_apply(img, make_lut(f));
+}
+}
+
+// out[i] = OutputType(f(img[i])). When both types are uint8_t, f is only
+// evaluated for the 256 possible inputs and the result goes through
+// lut_apply, so f can be as branchy as it likes
+template <typename OutputType, typename InputType, typename Function>
+MatrixX<OutputType> map_pixels(const MatrixX<InputType>& img, Function f)
+{
+    using IsByteMap =
+        std::integral_constant<bool,
+                               std::is_same<InputType, uint8_t>::value &&
+                                   std::is_same<OutputType, uint8_t>::value>;
+    return impl::map_pixels<OutputType>(img, f, IsByteMap());
+}
+}
+
+#endif
@@ -0,0 +1,34 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_POINTS_H
+#define SIPL_IMPROC_POINTS_H
+
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <cstdint>
+#include <vector>
+
+namespace sipl
+{
+
+// Map n points (xs[k], ys[k]) through the 3x3 transform m into
+// (out_xs[k], out_ys[k]), the same as homogenize(m * Vector3d{x, y, 1}) for
+// each point. The outputs may alias the inputs. Affine maps (last row 0 0 1)
+// skip the divide; both kinds run two points at a time with SSE2 where
+// available. Points mapped to w == 0 come out infinite or NaN, as with
+// homogenize
+void transform_points(const Matrix33d& m,
+                      const double* xs,
+                      const double* ys,
+                      int32_t n,
+                      double* out_xs,
+                      double* out_ys);
+
+// Same, for points stored as {x, y} vectors. out is resized to match points
+// and may be the same vector
+void transform_points(const Matrix33d& m,
+                      const std::vector<Vector2d>& points,
+                      std::vector<Vector2d>& out);
+}
+
+#endif
@@ -0,0 +1,115 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_RESIZE_H
+#define SIPL_IMPROC_RESIZE_H
+
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <cstdint>
+
+namespace sipl
+{
+
+// How resize() weighs source pixels:
+//   AREA:    each output pixel averages the source area it covers. The right
+//            choice for shrinking; no aliasing, no ringing
+//   LANCZOS: windowed sinc with 3 lobes, stretched by the scale factor when
+//            shrinking. Sharper, with slight ringing at hard edges
+enum class ResizeMethod { AREA, LANCZOS };
+
+// 8-bit resampling. Borders replicate the edge pixels, and every routine
+// splits its output rows across nthreads threads (<= 0: one per core).
+// Multi-channel images (RgbPixel, ...) go through channel by channel
+
+// Mean of each factor x factor block. Rows and columns past the last whole
+// block are dropped
+MatrixXb downsample_box(const MatrixXb& img,
+                        int32_t factor,
+                        int32_t nthreads = 0);
+
+// Gaussian pyramid level: blur with the 5-tap [1 4 6 4 1] / 16 binomial
+// filter in both directions and keep every other pixel, in one pass.
+// Output is ((rows + 1) / 2) x ((cols + 1) / 2)
+MatrixXb pyr_down(const MatrixXb& img, int32_t nthreads = 0);
+
+// Inverse of pyr_down: double the size and interpolate with the same filter
+MatrixXb pyr_up(const MatrixXb& img, int32_t nthreads = 0);
+
+// Resample to rows x cols at any ratio. Separable: per-axis tables of taps
+// and 14-bit weights are computed once per call, then each output row is a
+// vertical pass over its source rows followed by a horizontal one
+MatrixXb resize(const MatrixXb& img,
+                int32_t rows,
+                int32_t cols,
+                ResizeMethod method = ResizeMethod::AREA,
+                int32_t nthreads = 0);
+
+namespace impl
+{
+
+// Run a single-channel 8-bit operation on each channel of img
+template <int32_t Length, typename Function>
+MatrixX<Vector<uint8_t, Length>> per_channel(
+    const MatrixX<Vector<uint8_t, Length>>& img, Function f)
+{
+    MatrixX<Vector<uint8_t, Length>> out(0, 0);
+    MatrixXb plane(img.dims);
+    for (int32_t c = 0; c < Length; ++c) {
+        for (int32_t i = 0; i < img.size(); ++i) {
+            plane[i] = img[i][c];
+        }
+        const MatrixXb result = f(plane);
+        if (c == 0) {
+            out = MatrixX<Vector<uint8_t, Length>>(result.dims);
+        }
+        for (int32_t i = 0; i < result.size(); ++i) {
+            out[i][c] = result[i];
+        }
+    }
+    return out;
+}
+}
+
+template <int32_t Length>
+MatrixX<Vector<uint8_t, Length>> downsample_box(
+    const MatrixX<Vector<uint8_t, Length>>& img,
+    int32_t factor,
+    int32_t nthreads = 0)
+{
+    return impl::per_channel(img, [&](const MatrixXb& plane) {
+        return downsample_box(plane, factor, nthreads);
+    });
+}
+
+template <int32_t Length>
+MatrixX<Vector<uint8_t, Length>> pyr_down(
+    const MatrixX<Vector<uint8_t, Length>>& img, int32_t nthreads = 0)
+{
+    return impl::per_channel(img, [&](const MatrixXb& plane) {
+        return pyr_down(plane, nthreads);
+    });
+}
+
+template <int32_t Length>
+MatrixX<Vector<uint8_t, Length>> pyr_up(
+    const MatrixX<Vector<uint8_t, Length>>& img, int32_t nthreads = 0)
+{
+    return impl::per_channel(
+        img, [&](const MatrixXb& plane) { return pyr_up(plane, nthreads); });
+}
+
+template <int32_t Length>
+MatrixX<Vector<uint8_t, Length>> resize(
+    const MatrixX<Vector<uint8_t, Length>>& img,
+    int32_t rows,
+    int32_t cols,
+    ResizeMethod method = ResizeMethod::AREA,
+    int32_t nthreads = 0)
+{
+    return impl::per_channel(img, [&](const MatrixXb& plane) {
+        return resize(plane, rows, cols, method, nthreads);
+    });
+}
+}
+
+#endif
@@ -0,0 +1,204 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_ROTATE_H
+#define SIPL_IMPROC_ROTATE_H
+
+#include "improc/BilinearInterpolator.hpp"
+#include "matrix/Matrix"
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace sipl
+{
+
+namespace impl
+{
+
+// Side of the square tiles transposes work in. A tile's source rows and
+// destination rows both stay in L1 while it's copied
+constexpr int32_t TRANSPOSE_TILE = 32;
+
+// Copy a rows x cols image transposed: in(r, c) goes to
+// out[c * row_step + r * col_step]. Negative steps (with out pointing at the
+// far end) give the rotations
+template <typename Dtype>
+void transpose_copy(const Dtype* in,
+                    int32_t rows,
+                    int32_t cols,
+                    Dtype* out,
+                    ptrdiff_t row_step,
+                    ptrdiff_t col_step)
+{
+    for (int32_t r0 = 0; r0 < rows; r0 += TRANSPOSE_TILE) {
+        const int32_t r1 = std::min(r0 + TRANSPOSE_TILE, rows);
+        for (int32_t c0 = 0; c0 < cols; c0 += TRANSPOSE_TILE) {
+            const int32_t c1 = std::min(c0 + TRANSPOSE_TILE, cols);
+            for (int32_t c = c0; c < c1; ++c) {
+                Dtype* dst = out + c * row_step;
+                for (int32_t r = r0; r < r1; ++r) {
+                    dst[r * col_step] = in[ptrdiff_t(r) * cols + c];
+                }
+            }
+        }
+    }
+}
+
+// 8-bit images transpose 8 x 8 blocks in SSE2 registers. Only col_step of
+// +-1 is supported, which is all the operations below use
+void transpose_copy(const uint8_t* in,
+                    int32_t rows,
+                    int32_t cols,
+                    uint8_t* out,
+                    ptrdiff_t row_step,
+                    ptrdiff_t col_step);
+
+// out[i] = in[n - 1 - i]
+template <typename Dtype>
+void reverse_row(const Dtype* in, Dtype* out, int32_t n)
+{
+    std::reverse_copy(in, in + n, out);
+}
+
+void reverse_row(const uint8_t* in, uint8_t* out, int32_t n);
+
+// (1 - f) * a + f * b, rounded back to a pixel
+template <typename Dtype>
+Dtype lerp(const Dtype& a, const Dtype& b, double f)
+{
+    return to_pixel((1 - f) * a + f * b, static_cast<Dtype*>(nullptr));
+}
+
+// Output pixels [begin, end) of a row of m that land within [0, n - 1] when
+// shifted by shift
+inline void shift_bounds(int32_t n,
+                         double shift,
+                         int32_t m,
+                         int32_t& begin,
+                         int32_t& end)
+{
+    begin = int32_t(std::min(std::max(std::ceil(-shift), 0.0), double(m)));
+    end = int32_t(std::min(
+        std::max(std::floor(n - 1 - shift) + 1, double(begin)), double(m)));
+}
+
+// out[j] = in at position j + shift, linearly interpolated, for the m pixels
+// of out. Positions outside [0, n - 1] get fill_value. The shift is the same
+// for the whole row, so every pixel uses the same two weights
+template <typename Dtype>
+void shift_row(const Dtype* in,
+               int32_t n,
+               double shift,
+               Dtype* out,
+               int32_t m,
+               const Dtype& fill_value)
+{
+    int32_t begin, end;
+    shift_bounds(n, shift, m, begin, end);
+    std::fill(out, out + begin, fill_value);
+    std::fill(out + end, out + m, fill_value);
+    if (begin == end) {
+        return;
+    }
+
+    const double base = std::floor(shift);
+    const double f = shift - base;
+    const auto offset = int32_t(base);
+    for (int32_t j = begin; j < end; ++j) {
+        out[j] = f == 0 ? in[j + offset]
+                        : lerp(in[j + offset], in[j + offset + 1], f);
+    }
+}
+
+// 8-bit rows blend with 1/256 weights, 16 pixels at a time with SSE2
+void shift_row(const uint8_t* in,
+               int32_t n,
+               double shift,
+               uint8_t* out,
+               int32_t m,
+               uint8_t fill_value);
+}
+
+// Exact rotations, flips and transpose. Pixels are only moved, never
+// interpolated. Rotations are counterclockwise, as in rotate_image
+template <typename Dtype>
+MatrixX<Dtype> transpose(const MatrixX<Dtype>& img)
+{
+    MatrixX<Dtype> out(img.dims[1], img.dims[0]);
+    impl::transpose_copy(img.data(), img.dims[0], img.dims[1], out.data(),
+                         img.dims[0], 1);
+    return out;
+}
+
+template <typename Dtype>
+MatrixX<Dtype> rotate90(const MatrixX<Dtype>& img)
+{
+    // out(r, c) = img(c, cols - 1 - r): the transpose, rows bottom up
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    MatrixX<Dtype> out(cols, rows);
+    if (out.size() > 0) {
+        impl::transpose_copy(img.data(), rows, cols,
+                             out.data() + ptrdiff_t(cols - 1) * rows, -rows,
+                             1);
+    }
+    return out;
+}
+
+template <typename Dtype>
+MatrixX<Dtype> rotate270(const MatrixX<Dtype>& img)
+{
+    // out(r, c) = img(rows - 1 - c, r): the transpose, each row reversed
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    MatrixX<Dtype> out(cols, rows);
+    if (out.size() > 0) {
+        impl::transpose_copy(img.data(), rows, cols, out.data() + rows - 1,
+                             rows, -1);
+    }
+    return out;
+}
+
+template <typename Dtype>
+MatrixX<Dtype> rotate180(const MatrixX<Dtype>& img)
+{
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    MatrixX<Dtype> out(img.dims);
+    for (int32_t r = 0; r < rows; ++r) {
+        impl::reverse_row(img.data() + ptrdiff_t(r) * cols,
+                          out.data() + ptrdiff_t(rows - 1 - r) * cols, cols);
+    }
+    return out;
+}
+
+// Mirror left-right
+template <typename Dtype>
+MatrixX<Dtype> flip_h(const MatrixX<Dtype>& img)
+{
+    const int32_t cols = img.dims[1];
+    MatrixX<Dtype> out(img.dims);
+    for (int32_t r = 0; r < img.dims[0]; ++r) {
+        impl::reverse_row(img.data() + ptrdiff_t(r) * cols,
+                          out.data() + ptrdiff_t(r) * cols, cols);
+    }
+    return out;
+}
+
+// Mirror top-bottom
+template <typename Dtype>
+MatrixX<Dtype> flip_v(const MatrixX<Dtype>& img)
+{
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    MatrixX<Dtype> out(img.dims);
+    for (int32_t r = 0; r < rows; ++r) {
+        const Dtype* src = img.data() + ptrdiff_t(r) * cols;
+        std::copy(src, src + cols, out.data() + ptrdiff_t(rows - 1 - r) * cols);
+    }
+    return out;
+}
+}
+
+#endif
@@ -5,15 +5,32 @@
 
 #include "matrix/Matrix"
 #include "matrix/Vector"
+#include "improc/BicubicInterpolator.hpp"
 #include "improc/BilinearInterpolator.hpp"
+#include "improc/Interpolate.hpp"
+#include "improc/LanczosInterpolator.hpp"
 #include "improc/NearestNeighborInterpolator.hpp"
+#include "improc/Points.hpp"
+#include "improc/Rotate.hpp"
 #include "Common.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <array>
+#include <cmath>
+#include <limits>
+#include <vector>
 
 namespace sipl
 {
 
 // Possible interpolation types
-enum class InterpolateType { BILINEAR, NEAREST_NEIGHBOR, UNKNOWN };
+enum class InterpolateType {
+    BILINEAR,
+    NEAREST_NEIGHBOR,
+    BICUBIC,
+    LANCZOS,
+    UNKNOWN
+};
 
 // Specialized inverse for mat33d
 inline static Matrix33d inv(const Matrix33d& m)
@@ -33,54 +50,502 @@ inline static Matrix33d inv(const Matrix33d& m)
     return inverse / determinant;
 }
 
+namespace impl
+{
+
+// Output pixels whose source coordinates are computed together. The loops
+// over a block have a fixed trip count, so the compiler can vectorize them
+constexpr int32_t WARP_BLOCK = 8;
+
+// Source coordinates of runs of output pixels along a row. The inverse maps
+// output (u, v, 1) to source (X, Y, W), and one step right adds its first
+// column, so each block needs a single product up front; the pixels after
+// that are origin + k * step (not a running sum, which would drift).
+// Affine maps (last row 0 0 1) skip the per-pixel division
+class ScanlineMapper
+{
+public:
+    ScanlineMapper(const Matrix33d& inverse, double u_offset, double v_offset)
+        : m_(inverse)
+        , forward_(inv(inverse))
+        , u_offset_(u_offset)
+        , v_offset_(v_offset)
+        , affine_(inverse(2, 0) == 0 && inverse(2, 1) == 0 &&
+                  inverse(2, 2) == 1)
+    {
+    }
+
+    bool is_affine() const { return affine_; }
+
+    // Output columns [begin, end) of row i (of width columns) that can land
+    // within a pixel of a src_rows x src_cols source. Everything outside the
+    // span maps further out than any interpolator reads, so it's fill. The
+    // limits come from intersecting the row, a line in homogeneous source
+    // space, with the rectangle: a few linear inequalities in j, plus a pixel
+    // of slack for rounding
+    void clip(int32_t i,
+              int32_t width,
+              int32_t src_rows,
+              int32_t src_cols,
+              int32_t& begin,
+              int32_t& end) const
+    {
+        begin = 0;
+        end = width;
+        const double x_lo = -1;
+        const double y_lo = -1;
+        const double x_hi = src_cols;
+        const double y_hi = src_rows;
+
+        // If part of the source is behind the camera, positions with W < 0
+        // can land inside it too and the rectangle isn't a single span
+        for (const double x : {x_lo, x_hi}) {
+            for (const double y : {y_lo, y_hi}) {
+                if (forward_(2, 0) * x + forward_(2, 1) * y + forward_(2, 2) <=
+                    0) {
+                    return;
+                }
+            }
+        }
+
+        const double u = u_offset_;
+        const double v = i + v_offset_;
+        const double x0 = m_(0, 0) * u + m_(0, 1) * v + m_(0, 2);
+        const double y0 = m_(1, 0) * u + m_(1, 1) * v + m_(1, 2);
+        const double w0 = m_(2, 0) * u + m_(2, 1) * v + m_(2, 2);
+        const double dx = m_(0, 0);
+        const double dy = m_(1, 0);
+        const double dw = m_(2, 0);
+
+        // Narrow [lo, hi] to the j with a * j + b >= 0
+        double lo = -std::numeric_limits<double>::infinity();
+        double hi = std::numeric_limits<double>::infinity();
+        const auto keep = [&lo, &hi](double a, double b) {
+            if (a > 0) {
+                lo = std::max(lo, -b / a);
+            } else if (a < 0) {
+                hi = std::min(hi, -b / a);
+            } else if (b < 0) {
+                hi = -1;
+                lo = 1;
+            }
+        };
+        keep(dw, w0);
+        keep(dx - x_lo * dw, x0 - x_lo * w0);
+        keep(x_hi * dw - dx, x_hi * w0 - x0);
+        keep(dy - y_lo * dw, y0 - y_lo * w0);
+        keep(y_hi * dw - dy, y_hi * w0 - y0);
+
+        if (!(lo <= hi)) {
+            begin = end = 0;
+            return;
+        }
+        begin = int32_t(std::min(std::max(std::floor(lo) - 1, 0.0),
+                                 double(width)));
+        end = int32_t(std::min(std::max(std::ceil(hi) + 2, 0.0),
+                               double(width)));
+    }
+
+    // Source coordinates of output pixels (i, j) .. (i, j + WARP_BLOCK - 1)
+    void map(int32_t i, int32_t j, double* xs, double* ys) const
+    {
+        const double u = j + u_offset_;
+        const double v = i + v_offset_;
+        const double x0 = m_(0, 0) * u + m_(0, 1) * v + m_(0, 2);
+        const double y0 = m_(1, 0) * u + m_(1, 1) * v + m_(1, 2);
+        const double dx = m_(0, 0);
+        const double dy = m_(1, 0);
+        if (affine_) {
+            for (int32_t k = 0; k < WARP_BLOCK; ++k) {
+                xs[k] = x0 + k * dx;
+                ys[k] = y0 + k * dy;
+            }
+        } else {
+            const double w0 = m_(2, 0) * u + m_(2, 1) * v + m_(2, 2);
+            const double dw = m_(2, 0);
+            for (int32_t k = 0; k < WARP_BLOCK; ++k) {
+                const double w = w0 + k * dw;
+                xs[k] = (x0 + k * dx) / w;
+                ys[k] = (y0 + k * dy) / w;
+            }
+        }
+    }
+
+private:
+    Matrix33d m_;
+    Matrix33d forward_;
+    double u_offset_;
+    double v_offset_;
+    bool affine_;
+};
+
+// Interpolate a run of output pixels. Any interpolator works pixel by pixel;
+// bilinear on types with a fixed-point kernel goes through bilinear_span
+template <typename Interpolator, typename Dtype>
+void interpolate_span(Interpolator& interp,
+                      const MatrixX<Dtype>& img,
+                      const double* xs,
+                      const double* ys,
+                      int32_t n,
+                      Dtype* out,
+                      const Dtype& fill_value)
+{
+    for (int32_t k = 0; k < n; ++k) {
+        out[k] = interp(img, xs[k], ys[k], fill_value);
+    }
+}
+
+template <typename InternalType, typename Dtype>
+auto interpolate_span(BilinearInterpolator<InternalType>&,
+                      const MatrixX<Dtype>& img,
+                      const double* xs,
+                      const double* ys,
+                      int32_t n,
+                      Dtype* out,
+                      const Dtype& fill_value)
+    -> decltype(bilinear_span(img, xs, ys, n, out, fill_value))
+{
+    bilinear_span(img, xs, ys, n, out, fill_value);
+}
+
+// Output size when warping an image of src_dims by transform (the bounding
+// box of its transformed corners), and where output pixel (0, 0) sits in the
+// transformed plane
+struct WarpGeometry {
+    std::array<int32_t, 2> dims;
+    double u_offset;
+    double v_offset;
+};
+
+inline WarpGeometry warp_geometry(const std::array<int32_t, 2>& src_dims,
+                                  const Matrix33d& transform)
+{
+    const double right = src_dims[1] - 0.5;
+    const double bottom = src_dims[0] - 0.5;
+    double xs[4] = {-0.5, -0.5, right, right};
+    double ys[4] = {-0.5, bottom, -0.5, bottom};
+    transform_points(transform, xs, ys, 4, xs, ys);
+
+    // Raise or lower values as needed
+    const auto x_range = std::minmax_element(xs, xs + 4);
+    const auto y_range = std::minmax_element(ys, ys + 4);
+    return {{int32_t(*y_range.second - *y_range.first),
+             int32_t(*x_range.second - *x_range.first)},
+            *x_range.first,
+            *y_range.first};
+}
+
+// Source bytes a tile of output may touch: half of a typical 256 KB L2,
+// leaving the rest for the output tile and the interpolator's neighbors
+constexpr double WARP_TILE_BUDGET = 128 * 1024;
+
+// Largest output tile side, so even small footprints give enough tiles to
+// spread across threads
+constexpr int32_t WARP_TILE_MAX = 512;
+
+// Output rows per thread below which splitting row order work doesn't pay
+constexpr int32_t WARP_MIN_ROWS = 16;
+
+// Side of the square output tiles whose source footprint fits in
+// WARP_TILE_BUDGET. One output step right or down moves the source position
+// by the map's derivatives there, so a side x side tile covers roughly
+// side * (|dx/dj| + |dx/di|) by side * (|dy/dj| + |dy/di|) source pixels.
+// The derivatives are taken at the center of the output
+inline int32_t warp_tile_side(const ScanlineMapper& mapper,
+                              const std::array<int32_t, 2>& dims,
+                              size_t pixel_bytes)
+{
+    double xs[WARP_BLOCK], ys[WARP_BLOCK];
+    double xs_down[WARP_BLOCK], ys_down[WARP_BLOCK];
+    mapper.map(dims[0] / 2, dims[1] / 2, xs, ys);
+    mapper.map(dims[0] / 2 + 1, dims[1] / 2, xs_down, ys_down);
+    const double width = std::abs(xs[1] - xs[0]) + std::abs(xs_down[0] - xs[0]);
+    const double height =
+        std::abs(ys[1] - ys[0]) + std::abs(ys_down[0] - ys[0]);
+
+    // Shrinking maps have large footprints; degenerate ones are treated as 1:1
+    double area = width * height;
+    if (!(area > 0) || !std::isfinite(area)) {
+        area = 1;
+    }
+    const double side = std::sqrt(WARP_TILE_BUDGET / (area * pixel_bytes));
+    const auto blocks = int32_t(std::min(side, double(WARP_TILE_MAX))) /
+                        WARP_BLOCK;
+    return std::max(blocks, 1) * WARP_BLOCK;
+}
+
+// Warp output columns [begin, end) of row i, which starts at out
+template <typename Interpolator, typename Dtype>
+void warp_span(Interpolator& interp,
+               const ScanlineMapper& mapper,
+               const MatrixX<Dtype>& image,
+               int32_t i,
+               int32_t begin,
+               int32_t end,
+               Dtype* out,
+               const Dtype& fill_value)
+{
+    double src_x[WARP_BLOCK];
+    double src_y[WARP_BLOCK];
+    for (int32_t j = begin; j < end; j += WARP_BLOCK) {
+        mapper.map(i, j, src_x, src_y);
+        const int32_t n = std::min(WARP_BLOCK, end - j);
+        interpolate_span(interp, image, src_x, src_y, n, out + j, fill_value);
+    }
+}
+}
+
+// Order projective_transform visits output pixels in:
+//   ROWS:  row by row. Each output row reads a line across the source, which
+//          for rotations and shears cuts through many source rows
+//   TILED: square output tiles sized so the source area each one reads
+//          stays in L2, handed out to threads a run of tiles at a time.
+//          Keeps large rotations memory-bound rather than latency-bound
+//   AUTO:  TILED when the source is larger than that cache budget
+enum class WarpOrder { AUTO, ROWS, TILED };
+
+// Warp image by transform. The output is the bounding box of the warped
+// image, and pixels that don't map onto the source get fill_value. Rows or
+// tiles are split across nthreads threads (<= 0: one per core), each with its
+// own Interpolator
 template <typename Interpolator, typename ElementType>
 MatrixX<ElementType> projective_transform(
     const MatrixX<ElementType>& image,
     const Matrix33d& transform,
-    const ElementType fill_value = ElementType(0))
+    const ElementType fill_value = ElementType(0),
+    WarpOrder order = WarpOrder::AUTO,
+    int32_t nthreads = 0)
 {
-    // 1. Figure out sizes of new matrix
-    auto c0 = homogenize(transform * Vector3d{-0.5, -0.5, 1});
-    auto c1 = homogenize(transform * Vector3d{-0.5, image.dims[0] - 0.5, 1});
-    auto c2 = homogenize(transform * Vector3d{image.dims[1] - 0.5, -0.5, 1});
-    auto c3 = homogenize(transform *
-                         Vector3d{image.dims[1] - 0.5, image.dims[0] - 0.5, 1});
+    // Create new matrix big enough for the transformed image
+    const auto geometry = impl::warp_geometry(image.dims, transform);
+    MatrixX<ElementType> new_image(geometry.dims);
+    const int32_t rows = new_image.dims[0];
+    const int32_t cols = new_image.dims[1];
 
-    // Raise or lower values as needed
-    auto xs = Vector4d{c0[0], c1[0], c2[0], c3[0]};
-    auto ys = Vector4d{c0[1], c1[1], c2[1], c3[1]};
-
-    // Create new matrix
-    Matrix33d inverse = inv(transform);
-    MatrixX<ElementType> new_image(int32_t(ys.max() - ys.min()),
-                                   int32_t(xs.max() - xs.min()));
-
-    // Do interpolation for each output pixel
-    Interpolator interp;
-    for (int32_t i = 0; i < new_image.dims[0]; ++i) {
-        for (int32_t j = 0; j < new_image.dims[1]; ++j) {
-            Vector3d uv{j + xs.min(), i + ys.min(), 1};
-            Vector3d xy = homogenize(inverse * uv);
-            new_image(i, j) = interp(image, xy[0], xy[1], fill_value);
-        }
+    const impl::ScanlineMapper mapper(inv(transform), geometry.u_offset,
+                                      geometry.v_offset);
+    if (order == WarpOrder::AUTO) {
+        const double source_bytes =
+            double(image.size()) * sizeof(ElementType);
+        order = source_bytes > impl::WARP_TILE_BUDGET ? WarpOrder::TILED
+                                                      : WarpOrder::ROWS;
     }
 
+    // Only the part of a row that maps onto the source needs interpolating;
+    // the rest is filled outright
+    const auto clip = [&](int32_t i, int32_t& begin, int32_t& end) {
+        mapper.clip(i, cols, image.dims[0], image.dims[1], begin, end);
+    };
+
+    if (order == WarpOrder::ROWS) {
+        parallel_for(0, rows,
+                     [&](int32_t first, int32_t last) {
+                         Interpolator interp;
+                         for (int32_t i = first; i < last; ++i) {
+                             ElementType* row = new_image.data() + i * cols;
+                             int32_t begin, end;
+                             clip(i, begin, end);
+                             std::fill(row, row + begin, fill_value);
+                             std::fill(row + end, row + cols, fill_value);
+                             impl::warp_span(interp, mapper, image, i, begin,
+                                             end, row, fill_value);
+                         }
+                     },
+                     nthreads, impl::WARP_MIN_ROWS);
+        return new_image;
+    }
+
+    // Tiles are numbered row-major, so a run of tiles is mostly a strip of
+    // one band of rows. Each band's clipped spans are computed once
+    const int32_t side =
+        impl::warp_tile_side(mapper, new_image.dims, sizeof(ElementType));
+    const int32_t tile_rows = (rows + side - 1) / side;
+    const int32_t tile_cols = (cols + side - 1) / side;
+    parallel_for(
+        0, tile_rows * tile_cols,
+        [&](int32_t first, int32_t last) {
+            Interpolator interp;
+            std::vector<int32_t> begins(static_cast<size_t>(side));
+            std::vector<int32_t> ends(static_cast<size_t>(side));
+            int32_t band = -1;
+            for (int32_t t = first; t < last; ++t) {
+                const int32_t i0 = t / tile_cols * side;
+                const int32_t i1 = std::min(i0 + side, rows);
+                const int32_t j0 = t % tile_cols * side;
+                const int32_t j1 = std::min(j0 + side, cols);
+                if (t / tile_cols != band) {
+                    band = t / tile_cols;
+                    for (int32_t i = i0; i < i1; ++i) {
+                        clip(i, begins[size_t(i - i0)], ends[size_t(i - i0)]);
+                    }
+                }
+
+                for (int32_t i = i0; i < i1; ++i) {
+                    ElementType* row = new_image.data() + i * cols;
+                    const int32_t begin =
+                        std::min(std::max(begins[size_t(i - i0)], j0), j1);
+                    const int32_t end =
+                        std::min(std::max(ends[size_t(i - i0)], begin), j1);
+                    std::fill(row + j0, row + begin, fill_value);
+                    std::fill(row + end, row + j1, fill_value);
+                    impl::warp_span(interp, mapper, image, i, begin, end, row,
+                                    fill_value);
+                }
+            }
+        },
+        nthreads);
+
     return new_image;
 }
 
+// Rotate by any angle with three shears (Paeth): rows shifted by
+// -tan(theta / 2) * y, columns by sin(theta) * x, then rows again. Each pass
+// is a 1-D linear interpolation with the same two weights across a row,
+// reading and writing row by row (columns are transposed into rows first),
+// with the rows split across nthreads threads (<= 0: one per core). Whole
+// quarter turns are taken out first and done exactly, so the shears never
+// exceed 45 degrees. Output size and placement match projective_transform's;
+// the edges come out blended with fill_value
+template <typename Dtype>
+MatrixX<Dtype> rotate_three_shear(const MatrixX<Dtype>& in_mat,
+                                  double degrees,
+                                  const Dtype fill_value = Dtype(0),
+                                  int32_t nthreads = 0)
+{
+    const double turns = std::round(degrees / 90);
+    double quarter = std::fmod(turns, 4.0);
+    if (quarter < 0) {
+        quarter += 4;
+    }
+    MatrixX<Dtype> turned(0, 0);
+    switch (int32_t(quarter)) {
+    case 1:
+        turned = rotate90(in_mat);
+        break;
+    case 2:
+        turned = rotate180(in_mat);
+        break;
+    case 3:
+        turned = rotate270(in_mat);
+        break;
+    default:
+        break;
+    }
+    const MatrixX<Dtype>& img = quarter == 0 ? in_mat : turned;
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+
+    // The inverse rotation, output to source, is x shear a, y shear b, x
+    // shear a. The passes apply them in reverse, source to output
+    const double rads = deg2rad(degrees - 90 * turns);
+    const double a = -std::tan(rads / 2);
+    const double b = std::sin(rads);
+    const Matrix33d rotation_matrix{{std::cos(rads), std::sin(rads), 0},
+                                    {-std::sin(rads), std::cos(rads), 0},
+                                    {0, 0, 1}};
+    const auto geometry = impl::warp_geometry(img.dims, rotation_matrix);
+
+    // First pass: each row shifted by a * y. The result keeps the source's
+    // rows; its columns cover the sheared source, with column j at x_offset + j
+    const double top = -0.5 * a;
+    const double bottom = (rows - 0.5) * a;
+    const double left = -0.5 - std::max(top, bottom);
+    const double right = cols - 0.5 - std::min(top, bottom);
+    const double x_offset = left + 0.5;
+    const auto width = int32_t(std::ceil(right - left));
+    MatrixX<Dtype> sheared_rows(rows, width);
+    parallel_for(0, rows,
+                 [&](int32_t first, int32_t last) {
+                     for (int32_t i = first; i < last; ++i) {
+                         impl::shift_row(img.data() + i * cols, cols,
+                                         x_offset + a * i,
+                                         sheared_rows.data() + i * width,
+                                         width, fill_value);
+                     }
+                 },
+                 nthreads, impl::WARP_MIN_ROWS);
+
+    // Second pass: each column shifted by b * x, onto the output's rows.
+    // Columns are made rows by transposing, so this pass streams too
+    const int32_t out_rows = geometry.dims[0];
+    const MatrixX<Dtype> columns = transpose(sheared_rows);
+    MatrixX<Dtype> shifted_columns(width, out_rows);
+    parallel_for(0, width,
+                 [&](int32_t first, int32_t last) {
+                     for (int32_t j = first; j < last; ++j) {
+                         impl::shift_row(
+                             columns.data() + j * rows, rows,
+                             geometry.v_offset + b * (x_offset + j),
+                             shifted_columns.data() + j * out_rows, out_rows,
+                             fill_value);
+                     }
+                 },
+                 nthreads, impl::WARP_MIN_ROWS);
+    const MatrixX<Dtype> sheared_cols = transpose(shifted_columns);
+
+    // Third pass: each row shifted by a * y again, onto the output's columns
+    MatrixX<Dtype> new_image(geometry.dims);
+    const int32_t out_cols = geometry.dims[1];
+    parallel_for(0, out_rows,
+                 [&](int32_t first, int32_t last) {
+                     for (int32_t i = first; i < last; ++i) {
+                         const double y = geometry.v_offset + i;
+                         impl::shift_row(
+                             sheared_cols.data() + i * width, width,
+                             geometry.u_offset + a * y - x_offset,
+                             new_image.data() + i * out_cols, out_cols,
+                             fill_value);
+                     }
+                 },
+                 nthreads, impl::WARP_MIN_ROWS);
+
+    return new_image;
+}
+
+// How rotate_image handles angles that aren't whole quarter turns:
+//   PROJECTIVE:  the general warp with the 2-D Interpolator
+//   THREE_SHEAR: rotate_three_shear, 1-D linear interpolation in three
+//                streaming passes. Cheaper per pixel on large images
+enum class RotateMethod { PROJECTIVE, THREE_SHEAR };
+
 // XXX only works for integral-typed matrices for now, need to figure out how to
 // get it to work for Vector-type matrices
 template <typename Dtype, typename Interpolator>
 MatrixX<Dtype> rotate_image(const MatrixX<Dtype>& in_mat,
                             double degrees,
-                            const Dtype fill_value = Dtype(0))
+                            const Dtype fill_value = Dtype(0),
+                            RotateMethod method = RotateMethod::PROJECTIVE,
+                            int32_t nthreads = 0)
 {
+    // Multiples of 90 degrees just move pixels around
+    const double quarter_turns = degrees / 90;
+    if (quarter_turns == std::round(quarter_turns)) {
+        double turns = std::fmod(quarter_turns, 4.0);
+        if (turns < 0) {
+            turns += 4;
+        }
+        switch (int32_t(turns)) {
+        case 1:
+            return rotate90(in_mat);
+        case 2:
+            return rotate180(in_mat);
+        case 3:
+            return rotate270(in_mat);
+        default:
+            return in_mat;
+        }
+    }
+
+    if (method == RotateMethod::THREE_SHEAR) {
+        return rotate_three_shear(in_mat, degrees, fill_value, nthreads);
+    }
+
     auto rads = deg2rad(degrees);
     Matrix33d rotation_matrix{{std::cos(rads), std::sin(rads), 0},
                               {-std::sin(rads), std::cos(rads), 0},
                               {0, 0, 1}};
-    return projective_transform<Interpolator>(in_mat, rotation_matrix,
-                                              fill_value);
+    return projective_transform<Interpolator>(
+        in_mat, rotation_matrix, fill_value, WarpOrder::AUTO, nthreads);
 }
 }
 
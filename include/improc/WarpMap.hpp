@@ -0,0 +1,82 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_WARPMAP_H
+#define SIPL_IMPROC_WARPMAP_H
+
+#include "improc/Transform.hpp"
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <array>
+#include <cstdint>
+#include <vector>
+
+namespace sipl
+{
+
+// A warp precomputed for one source size, for applying the same transform to
+// every frame of a sequence. Holds, per output pixel, the source pixel to read
+// from and the fixed-point (1/256) bilinear weights, so remap() does no
+// coordinate math at all. The output has the size and placement
+// projective_transform would give, and matches it to within 1 gray level
+// (bilinear and nearest neighbor only)
+class WarpMap
+{
+public:
+    WarpMap(const std::array<int32_t, 2>& src_dims,
+            const Matrix33d& transform,
+            InterpolateType interpolation = InterpolateType::BILINEAR,
+            int32_t nthreads = 0);
+
+    const std::array<int32_t, 2>& src_dims() const { return src_dims_; }
+
+    const std::array<int32_t, 2>& dims() const { return dims_; }
+
+    InterpolateType interpolation() const { return interpolation_; }
+
+    // Index of the source pixel (the top left of the four for BILINEAR) for
+    // output pixel i, or -1 where the output gets the fill value
+    int32_t offset(int32_t i) const { return offsets_[size_t(i)]; }
+
+    // Weights of the right column and bottom row, in 1/256ths
+    uint16_t weight_x(int32_t i) const { return weights_x_[size_t(i)]; }
+    uint16_t weight_y(int32_t i) const { return weights_y_[size_t(i)]; }
+
+private:
+    std::array<int32_t, 2> src_dims_;
+    std::array<int32_t, 2> dims_;
+    InterpolateType interpolation_;
+    std::vector<int32_t> offsets_;
+    std::vector<uint16_t> weights_x_;
+    std::vector<uint16_t> weights_y_;
+};
+
+// Warp frame (which must be map.src_dims() in size) into out, which is only
+// reallocated if it isn't already map.dims(). Bilinear output uses the same
+// fixed-point blend as bilinear_span, with its SSE2 kernel on runs of 8
+// pixels that all read the source. Rows are spread across nthreads threads
+// (<= 0: one per core)
+void remap(const MatrixXb& frame,
+           const WarpMap& map,
+           MatrixXb& out,
+           uint8_t fill_value = 0,
+           int32_t nthreads = 0);
+
+void remap(const MatrixX<RgbPixel>& frame,
+           const WarpMap& map,
+           MatrixX<RgbPixel>& out,
+           const RgbPixel& fill_value = RgbPixel{0, 0, 0},
+           int32_t nthreads = 0);
+
+template <typename Dtype>
+MatrixX<Dtype> remap(const MatrixX<Dtype>& frame,
+                     const WarpMap& map,
+                     const Dtype& fill_value = Dtype(0),
+                     int32_t nthreads = 0)
+{
+    MatrixX<Dtype> out(map.dims());
+    remap(frame, map, out, fill_value, nthreads);
+    return out;
+}
+}
+
+#endif
@@ -0,0 +1,338 @@
+#pragma once
+
+#ifndef SIPL_IMPROC_WINDOWHISTOGRAM_H
+#define SIPL_IMPROC_WINDOWHISTOGRAM_H
+
+#include "Parallel.hpp"
+#include "matrix/Matrix"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+namespace sipl
+{
+
+// Histogram of the 8-bit values in a window, kept up to date as pixels (or
+// whole column histograms) enter and leave. A second level of 16 coarse bins
+// lets rank queries skip over empty ranges: kth() looks at no more than 16
+// coarse and 16 fine bins
+class WindowHistogram
+{
+public:
+    WindowHistogram() { clear(); }
+
+    void clear()
+    {
+        fine_.fill(0);
+        coarse_.fill(0);
+        count_ = 0;
+    }
+
+    void add(uint8_t v)
+    {
+        ++fine_[v];
+        ++coarse_[v >> 4];
+        ++count_;
+    }
+
+    void remove(uint8_t v)
+    {
+        --fine_[v];
+        --coarse_[v >> 4];
+        --count_;
+    }
+
+    // Add or remove every value counted in other (e.g. a column of the window)
+    void add(const WindowHistogram& other)
+    {
+        for (int32_t i = 0; i < 256; ++i) {
+            fine_[size_t(i)] += other.fine_[size_t(i)];
+        }
+        for (int32_t i = 0; i < 16; ++i) {
+            coarse_[size_t(i)] += other.coarse_[size_t(i)];
+        }
+        count_ += other.count_;
+    }
+
+    void remove(const WindowHistogram& other)
+    {
+        for (int32_t i = 0; i < 256; ++i) {
+            fine_[size_t(i)] -= other.fine_[size_t(i)];
+        }
+        for (int32_t i = 0; i < 16; ++i) {
+            coarse_[size_t(i)] -= other.coarse_[size_t(i)];
+        }
+        count_ -= other.count_;
+    }
+
+    int32_t count() const { return count_; }
+
+    int32_t operator[](int32_t v) const { return fine_[size_t(v)]; }
+
+    // The kth smallest value (0-based), as if the window were sorted
+    uint8_t kth(int32_t k) const
+    {
+        assert(k >= 0 && k < count_ && "k out of bounds");
+        int32_t c = 0;
+        while (k >= coarse_[size_t(c)]) {
+            k -= coarse_[size_t(c)];
+            ++c;
+        }
+        int32_t v = c << 4;
+        while (k >= fine_[size_t(v)]) {
+            k -= fine_[size_t(v)];
+            ++v;
+        }
+        return uint8_t(v);
+    }
+
+    uint8_t median() const { return kth(count_ / 2); }
+
+    // Value at percentile p (0..100), nearest rank
+    uint8_t percentile(double p) const
+    {
+        const auto k = int32_t(std::round(p / 100.0 * (count_ - 1)));
+        return kth(std::min(std::max(k, 0), count_ - 1));
+    }
+
+    // Most frequent value, lowest on ties
+    uint8_t mode() const
+    {
+        int32_t best = 0;
+        for (int32_t v = 1; v < 256; ++v) {
+            if (fine_[size_t(v)] > fine_[size_t(best)]) {
+                best = v;
+            }
+        }
+        return uint8_t(best);
+    }
+
+private:
+    std::array<int32_t, 256> fine_;
+    std::array<int32_t, 16> coarse_;
+    int32_t count_;
+};
+
+// How sliding_histogram keeps the window histogram current:
+//   HUANG:         moving one pixel right removes the leaving column and adds
+//                  the entering one, O(window height) per pixel
+//   COLUMN_CACHED: one histogram per image column is slid down a row at a
+//                  time, and the window adds/removes whole column histograms,
+//                  O(1) per pixel whatever the window size
+//   AUTO:          HUANG for short windows, COLUMN_CACHED for tall ones
+enum class WindowMethod { AUTO, HUANG, COLUMN_CACHED };
+
+namespace impl
+{
+
+// Window heights at or above this are faster with cached column histograms
+constexpr int32_t COLUMN_CACHED_MIN_HEIGHT = 41;
+
+inline int32_t clamp_index(int32_t i, int32_t size)
+{
+    return std::min(std::max(i, 0), size - 1);
+}
+
+template <typename Function>
+void huang_rows(const MatrixXb& img,
+                int32_t ry,
+                int32_t rx,
+                int32_t row_begin,
+                int32_t row_end,
+                Function& f)
+{
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    std::vector<const uint8_t*> window_rows(static_cast<size_t>(2 * ry + 1));
+    WindowHistogram hist;
+    for (int32_t i = row_begin; i < row_end; ++i) {
+        for (int32_t y = -ry; y <= ry; ++y) {
+            window_rows[size_t(y + ry)] =
+                img.data() + clamp_index(i + y, rows) * cols;
+        }
+
+        hist.clear();
+        for (const auto row : window_rows) {
+            for (int32_t x = -rx; x <= rx; ++x) {
+                hist.add(row[clamp_index(x, cols)]);
+            }
+        }
+        f(i, 0, hist);
+
+        for (int32_t j = 1; j < cols; ++j) {
+            // Past the borders both ends can land on the same replicated
+            // column, which leaves the histogram unchanged
+            const int32_t leaving = clamp_index(j - 1 - rx, cols);
+            const int32_t entering = clamp_index(j + rx, cols);
+            if (leaving != entering) {
+                for (const auto row : window_rows) {
+                    hist.remove(row[leaving]);
+                    hist.add(row[entering]);
+                }
+            }
+            f(i, j, hist);
+        }
+    }
+}
+
+template <typename Function>
+void column_cached_rows(const MatrixXb& img,
+                        int32_t ry,
+                        int32_t rx,
+                        int32_t row_begin,
+                        int32_t row_end,
+                        Function& f)
+{
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    const auto row_ptr = [&](int32_t y) {
+        return img.data() + clamp_index(y, rows) * cols;
+    };
+
+    std::vector<WindowHistogram> columns(static_cast<size_t>(cols));
+    for (int32_t y = row_begin - ry; y <= row_begin + ry; ++y) {
+        const uint8_t* row = row_ptr(y);
+        for (int32_t c = 0; c < cols; ++c) {
+            columns[size_t(c)].add(row[c]);
+        }
+    }
+
+    WindowHistogram hist;
+    for (int32_t i = row_begin; i < row_end; ++i) {
+        if (i > row_begin) {
+            const uint8_t* leaving = row_ptr(i - 1 - ry);
+            const uint8_t* entering = row_ptr(i + ry);
+            for (int32_t c = 0; c < cols; ++c) {
+                columns[size_t(c)].remove(leaving[c]);
+                columns[size_t(c)].add(entering[c]);
+            }
+        }
+
+        hist.clear();
+        for (int32_t x = -rx; x <= rx; ++x) {
+            hist.add(columns[size_t(clamp_index(x, cols))]);
+        }
+        f(i, 0, hist);
+
+        for (int32_t j = 1; j < cols; ++j) {
+            const int32_t leaving = clamp_index(j - 1 - rx, cols);
+            const int32_t entering = clamp_index(j + rx, cols);
+            if (leaving != entering) {
+                hist.remove(columns[size_t(leaving)]);
+                hist.add(columns[size_t(entering)]);
+            }
+            f(i, j, hist);
+        }
+    }
+}
+}
+
+// Calls f(row, col, hist) for every pixel of img, where hist is the histogram
+// of the (2 * ry + 1) x (2 * rx + 1) window centered on it. Borders replicate
+// the edge pixels, as in Matrix::patch. Bands of rows are spread across
+// nthreads threads (<= 0: one per core), so f must be safe to call
+// concurrently for different pixels
+template <typename Function>
+void sliding_histogram(const MatrixXb& img,
+                       int32_t ry,
+                       int32_t rx,
+                       Function f,
+                       WindowMethod method = WindowMethod::AUTO,
+                       int32_t nthreads = 0)
+{
+    assert(ry >= 0 && rx >= 0 && "window radius must be non-negative");
+    if (img.size() == 0) {
+        return;
+    }
+    if (method == WindowMethod::AUTO) {
+        method = 2 * ry + 1 >= impl::COLUMN_CACHED_MIN_HEIGHT
+                     ? WindowMethod::COLUMN_CACHED
+                     : WindowMethod::HUANG;
+    }
+
+    // Every band starts by building its window (or column histograms) from
+    // scratch, so keep bands tall enough for that to pay off
+    const int32_t min_rows = std::max(16, 2 * ry + 1);
+    parallel_for(0, img.dims[0],
+                 [&](int32_t begin, int32_t end) {
+                     Function band_f = f;
+                     if (method == WindowMethod::HUANG) {
+                         impl::huang_rows(img, ry, rx, begin, end, band_f);
+                     } else {
+                         impl::column_cached_rows(img, ry, rx, begin, end,
+                                                  band_f);
+                     }
+                 },
+                 nthreads, min_rows);
+}
+
+// The kth smallest value (0-based) of the height x width window around every
+// pixel; height and width must be odd. Same result as sorting
+// img.patch(...) per pixel, without the sort
+inline MatrixXb rank_filter(const MatrixXb& img,
+                            int32_t height,
+                            int32_t width,
+                            int32_t k,
+                            WindowMethod method = WindowMethod::AUTO,
+                            int32_t nthreads = 0)
+{
+    assert(width % 2 == 1 && height % 2 == 1 && "width and height must be odd");
+    assert(k >= 0 && k < width * height && "k out of bounds");
+    MatrixXb out(img.dims);
+    sliding_histogram(img, height / 2, width / 2,
+                      [&out, k](int32_t i, int32_t j,
+                                const WindowHistogram& hist) {
+                          out(i, j) = hist.kth(k);
+                      },
+                      method, nthreads);
+    return out;
+}
+
+// Most frequent value in the height x width window around every pixel
+inline MatrixXb local_mode(const MatrixXb& img,
+                           int32_t height,
+                           int32_t width,
+                           WindowMethod method = WindowMethod::AUTO,
+                           int32_t nthreads = 0)
+{
+    assert(width % 2 == 1 && height % 2 == 1 && "width and height must be odd");
+    MatrixXb out(img.dims);
+    sliding_histogram(img, height / 2, width / 2,
+                      [&out](int32_t i, int32_t j,
+                             const WindowHistogram& hist) {
+                          out(i, j) = hist.mode();
+                      },
+                      method, nthreads);
+    return out;
+}
+
+// Binary image: 255 where a pixel is above the given percentile (0..100) of
+// its height x width neighborhood minus offset, 0 elsewhere. With percentile
+// 50 this is adaptive thresholding against the local median
+inline MatrixXb local_percentile_threshold(
+    const MatrixXb& img,
+    int32_t height,
+    int32_t width,
+    double percentile,
+    int32_t offset = 0,
+    WindowMethod method = WindowMethod::AUTO,
+    int32_t nthreads = 0)
+{
+    assert(width % 2 == 1 && height % 2 == 1 && "width and height must be odd");
+    assert(percentile >= 0 && percentile <= 100 && "percentile out of range");
+    MatrixXb out(img.dims);
+    sliding_histogram(img, height / 2, width / 2,
+                      [&](int32_t i, int32_t j, const WindowHistogram& hist) {
+                          const int32_t level =
+                              int32_t(hist.percentile(percentile)) - offset;
+                          out(i, j) = int32_t(img(i, j)) > level ? 255 : 0;
+                      },
+                      method, nthreads);
+    return out;
+}
+}
+
+#endif
@@ -47,6 +47,9 @@ public:
         DWORD biClrImportant;
     };
 
+    // Read just the file and info headers
+    static ImageInfo info(const std::string& filename);
+
     // Reading
     static MatrixXb read(const char* filename);
 
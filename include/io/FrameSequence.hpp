@@ -0,0 +1,197 @@
+#pragma once
+
+#ifndef SIPL_IO_FRAMESEQUENCE_HPP
+#define SIPL_IO_FRAMESEQUENCE_HPP
+
+#include "matrix/Matrix"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdio>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace sipl
+{
+
+// A numbered sequence of image files (e.g. video frames dumped to PNG) read in
+// order. Frames are decoded ahead of the consumer on a pool of worker threads
+// into a fixed ring of buffers, so decoding overlaps processing while at most
+// nbuffers frames are held in memory. Example:
+//
+//     FrameSequence<uint8_t> frames("frame%04d.png", 1, 300,
+//         [](const std::string& f, MatrixXb& gray) {
+//             gray = color_to_grayscale(PngIO::read(f));
+//         });
+//     MatrixXb frame(0, 0);
+//     while (frames.next(frame)) { ... }
+template <typename Dtype>
+class FrameSequence
+{
+public:
+    // Decodes the named file into frame. frame is a recycled buffer that may
+    // still hold an earlier frame, which loaders can reuse if the size matches
+    using Loader =
+        std::function<void(const std::string& filename, MatrixX<Dtype>& frame)>;
+
+    // Frames are format formatted with start, start + 1, ..., start + count - 1
+    // (printf-style, e.g. "img%03d.png"). nthreads <= 0 uses one worker per
+    // core, nbuffers <= 0 uses two buffers per worker
+    FrameSequence(const std::string& format,
+                  int32_t start,
+                  int32_t count,
+                  Loader loader,
+                  int32_t nthreads = 0,
+                  int32_t nbuffers = 0)
+        : format_(format)
+        , start_(start)
+        , count_(std::max(count, 0))
+        , loader_(loader)
+        , next_to_load_(0)
+        , next_to_read_(0)
+        , stop_(false)
+    {
+        if (nthreads <= 0) {
+            nthreads = std::max(1, int32_t(std::thread::hardware_concurrency()));
+        }
+        if (nbuffers <= 0) {
+            nbuffers = 2 * nthreads;
+        }
+        slots_ = std::vector<Slot>(size_t(nbuffers));
+        workers_.reserve(size_t(nthreads));
+        for (int32_t i = 0; i < nthreads; ++i) {
+            workers_.emplace_back([this]() { work(); });
+        }
+    }
+
+    FrameSequence(const FrameSequence&) = delete;
+    FrameSequence& operator=(const FrameSequence&) = delete;
+
+    ~FrameSequence()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        cv_.notify_all();
+        for (auto& w : workers_) {
+            w.join();
+        }
+    }
+
+    int32_t size() const { return count_; }
+
+    // Filename of the i'th frame of the sequence (0-based)
+    std::string filename(int32_t i) const
+    {
+        // Code taken from: http://stackoverflow.com/a/26221725
+        // + 1 for null terminator
+        const int32_t n = start_ + i;
+        size_t size = std::snprintf(nullptr, 0, format_.c_str(), n) + 1;
+        auto buf = std::make_unique<char[]>(size);
+        std::snprintf(buf.get(), size, format_.c_str(), n);
+        return std::string(buf.get(), buf.get() + size - 1);
+    }
+
+    // Get the next frame in order, waiting for it to finish decoding if it
+    // hasn't yet. The frame is swapped into frame, and frame's old buffer goes
+    // back into the ring to decode a later frame into. Returns false once
+    // every frame has been read. Rethrows anything the loader threw
+    bool next(MatrixX<Dtype>& frame)
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (next_to_read_ >= count_) {
+            return false;
+        }
+
+        const int32_t index = next_to_read_;
+        auto& slot = slot_for(index);
+        cv_.wait(lock, [&slot, index]() {
+            return slot.state == SlotState::READY && slot.index == index;
+        });
+
+        std::swap(frame, slot.frame);
+        auto error = slot.error;
+        slot.error = nullptr;
+        slot.state = SlotState::EMPTY;
+        ++next_to_read_;
+        lock.unlock();
+        cv_.notify_all();
+
+        if (error) {
+            std::rethrow_exception(error);
+        }
+        return true;
+    }
+
+private:
+    enum class SlotState { EMPTY, LOADING, READY };
+
+    struct Slot {
+        MatrixX<Dtype> frame;
+        SlotState state;
+        int32_t index;
+        std::exception_ptr error;
+
+        Slot() : frame(0, 0), state(SlotState::EMPTY), index(-1), error() {}
+    };
+
+    std::string format_;
+    int32_t start_;
+    int32_t count_;
+    Loader loader_;
+
+    // All below guarded by mutex_
+    std::vector<Slot> slots_;
+    int32_t next_to_load_;
+    int32_t next_to_read_;
+    bool stop_;
+
+    std::mutex mutex_;
+    std::condition_variable cv_;
+    std::vector<std::thread> workers_;
+
+    // Frame i always goes in the same slot, which is free once frame
+    // i - nbuffers has been consumed
+    Slot& slot_for(int32_t index) { return slots_[index % slots_.size()]; }
+
+    void work()
+    {
+        std::unique_lock<std::mutex> lock(mutex_);
+        while (true) {
+            cv_.wait(lock, [this]() {
+                return stop_ || next_to_load_ >= count_ ||
+                       slot_for(next_to_load_).state == SlotState::EMPTY;
+            });
+            if (stop_ || next_to_load_ >= count_) {
+                return;
+            }
+
+            // Claim the frame, then decode it without holding the lock
+            const int32_t index = next_to_load_++;
+            auto& slot = slot_for(index);
+            slot.state = SlotState::LOADING;
+            slot.index = index;
+            lock.unlock();
+
+            std::exception_ptr error;
+            try {
+                loader_(filename(index), slot.frame);
+            } catch (...) {
+                error = std::current_exception();
+            }
+
+            lock.lock();
+            slot.error = error;
+            slot.state = SlotState::READY;
+            cv_.notify_all();
+        }
+    }
+};
+}
+
+#endif
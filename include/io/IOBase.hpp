@@ -3,6 +3,7 @@
 #ifndef SIPL_IO_IOBASE_HPP
 #define SIPL_IO_IOBASE_HPP
 
+#include <cstdint>
 #include <stdexcept>
 #include <string>
 
@@ -10,7 +11,18 @@ namespace sipl
 {
 
 // Current supported file types
-enum class FileType { PGM, PPM, BMP, UNKNOWN };
+enum class FileType { PGM, PPM, BMP, PNG, UNKNOWN };
+
+// What can be learned about an image from its file header alone. channels and
+// bit_depth describe the samples as stored in the file (e.g. a paletted PNG
+// has 1 channel of palette indices)
+struct ImageInfo {
+    FileType type;
+    int32_t width;
+    int32_t height;
+    int32_t channels;
+    int32_t bit_depth;
+};
 
 // From: http://stackoverflow.com/a/8152888
 class IOException : public std::exception
@@ -3,10 +3,12 @@
 #ifndef SIPL_IO_IMAGEIO_H
 #define SIPL_IO_IMAGEIO_H
 
+#include <fstream>
 #include <string>
 #include "io/IOBase.hpp"
 #include "io/PgmIO.hpp"
 #include "io/PpmIO.hpp"
+#include "io/PngIO.hpp"
 #include "io/BmpIO.hpp"
 #include "matrix/Matrix"
 
@@ -28,10 +30,16 @@ public:
         switch (file_type(filename)) {
         case FileType::PGM:
             img = PgmIO::read(filename);
+            break;
         case FileType::PPM:
             img = PpmIO::read(filename);
+            break;
         case FileType::BMP:
             img = BmpIO::read(filename);
+            break;
+        case FileType::PNG:
+            img = PngIO::read(filename);
+            break;
         case FileType::UNKNOWN:
             throw IOException("Unknown file type: " + filename);
         }
@@ -56,6 +64,9 @@ public:
         case FileType::BMP:
             BmpIO::write(img, filename);
             break;
+        case FileType::PNG:
+            PngIO::write(img, filename);
+            break;
         case FileType::UNKNOWN:
             throw IOException("Unknown file type: " + filename);
         }
@@ -74,10 +85,61 @@ public:
             return FileType::PPM;
         } else if (extname == "bmp") {
             return FileType::BMP;
+        } else if (extname == "png") {
+            return FileType::PNG;
+        } else {
+            return FileType::UNKNOWN;
+        }
+    }
+
+    // Identify the format by the magic bytes at the start of the file rather
+    // than by the extension
+    static FileType file_type_from_contents(const std::string& filename)
+    {
+        std::ifstream stream{filename, std::ios::binary};
+        if (!stream) {
+            throw IOException("Could not open file '" + filename + "'");
+        }
+
+        unsigned char magic[8] = {0};
+        stream.read(reinterpret_cast<char*>(magic), sizeof(magic));
+        static const unsigned char png_magic[8] = {0x89, 'P',  'N',  'G',
+                                                   '\r', '\n', 0x1a, '\n'};
+        if (std::equal(std::begin(png_magic), std::end(png_magic), magic)) {
+            return FileType::PNG;
+        } else if (magic[0] == 'B' && magic[1] == 'M') {
+            return FileType::BMP;
+        } else if (magic[0] == 'P' && (magic[1] == '2' || magic[1] == '5')) {
+            return FileType::PGM;
+        } else if (magic[0] == 'P' && (magic[1] == '3' || magic[1] == '6')) {
+            return FileType::PPM;
         } else {
             return FileType::UNKNOWN;
         }
     }
+
+    // Get format, dimensions, channels and bit depth by reading only the
+    // file's header (Netpbm header, BMP info header or PNG IHDR chunk)
+    static ImageInfo probe(const char* filename)
+    {
+        return probe(std::string(filename));
+    }
+
+    static ImageInfo probe(const std::string& filename)
+    {
+        switch (file_type_from_contents(filename)) {
+        case FileType::PGM:
+        case FileType::PPM:
+            return NetpbmIOBase::info(filename);
+        case FileType::BMP:
+            return BmpIO::info(filename);
+        case FileType::PNG:
+            return PngIO::info(filename);
+        case FileType::UNKNOWN:
+            break;
+        }
+        throw IOException("Unknown file type: " + filename);
+    }
 };
 }
 
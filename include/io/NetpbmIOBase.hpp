@@ -32,6 +32,9 @@ class NetpbmIOBase : public IOBase
 public:
     enum class FileType { BINARY, ASCII, UNKNOWN };
 
+    // Read just the header of a PGM or PPM file
+    static ImageInfo info(const std::string& filename);
+
 protected:
     static std::tuple<int32_t, int32_t, int32_t> process_header(
         std::ifstream& stream);
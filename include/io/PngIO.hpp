@@ -14,14 +14,23 @@ namespace sipl
 class PngIO : public IOBase
 {
 public:
+    // Read just the signature and IHDR chunk
+    static ImageInfo info(const std::string& filename);
+
     static MatrixX<RgbPixel> read(const char* filename);
 
     static MatrixX<RgbPixel> read(const std::string& filename);
 
-    static void write(const MatrixX<RgbPixel>& mat, const char* filename);
+    // With nthreads > 1, horizontal bands of the image are deflated on
+    // separate threads and joined into a single zlib stream (like pigz). The
+    // result is a standard PNG. nthreads <= 0 uses one thread per core
+    static void write(const MatrixX<RgbPixel>& mat,
+                      const char* filename,
+                      int32_t nthreads = 1);
 
     static void write(const MatrixX<RgbPixel>& mat,
-                      const std::string& filename);
+                      const std::string& filename,
+                      int32_t nthreads = 1);
 };
 }
 
@@ -0,0 +1,224 @@
+#pragma once
+
+#ifndef SIPL_IO_SCANLINEIO_HPP
+#define SIPL_IO_SCANLINEIO_HPP
+
+#include "io/IOBase.hpp"
+#include "io/NetpbmIOBase.hpp"
+#include "matrix/Matrix"
+#include <fstream>
+#include <string>
+#include <vector>
+
+namespace sipl
+{
+
+// Reads an image a few rows at a time, top to bottom, instead of
+// materializing the whole thing in a MatrixX. Lets filters that only need a
+// bounded number of neighboring rows work on images that don't fit in memory.
+template <typename Dtype>
+class ScanlineReader
+{
+public:
+    ScanlineReader() : rows_(0), cols_(0), rows_read_(0) {}
+
+    virtual ~ScanlineReader() {}
+
+    int32_t rows() const { return rows_; }
+
+    int32_t cols() const { return cols_; }
+
+    int32_t rows_read() const { return rows_read_; }
+
+    bool done() const { return rows_read_ == rows_; }
+
+    // Read up to nrows of the next rows into buf. buf is only reallocated if
+    // its shape changes (i.e. for the last, shorter, batch). Returns the number
+    // of rows read, which is 0 once every row has been read
+    int32_t read(MatrixX<Dtype>& buf, int32_t nrows)
+    {
+        const int32_t n = std::min(nrows, rows_ - rows_read_);
+        if (n <= 0) {
+            return 0;
+        }
+        if (buf.dims[0] != n || buf.dims[1] != cols_) {
+            buf = MatrixX<Dtype>(n, cols_);
+        }
+        read_rows(buf.data(), n);
+        rows_read_ += n;
+        return n;
+    }
+
+protected:
+    int32_t rows_;
+    int32_t cols_;
+    int32_t rows_read_;
+
+    // Fill nrows * cols_ pixels of out with the next rows
+    virtual void read_rows(Dtype* out, int32_t nrows) = 0;
+};
+
+// Writes an image a few rows at a time, top to bottom. The image dimensions
+// have to be known up front. close() (or destruction) finishes the file
+template <typename Dtype>
+class ScanlineWriter
+{
+public:
+    ScanlineWriter(int32_t rows, int32_t cols)
+        : rows_(rows), cols_(cols), rows_written_(0)
+    {
+    }
+
+    virtual ~ScanlineWriter() {}
+
+    int32_t rows() const { return rows_; }
+
+    int32_t cols() const { return cols_; }
+
+    int32_t rows_written() const { return rows_written_; }
+
+    // Append the rows of buf below the ones already written
+    void write(const MatrixX<Dtype>& buf)
+    {
+        if (buf.dims[1] != cols_) {
+            throw IOException("scanline width doesn't match image width");
+        }
+        if (rows_written_ + buf.dims[0] > rows_) {
+            throw IOException("more rows written than the image has");
+        }
+        write_rows(buf.data(), buf.dims[0]);
+        rows_written_ += buf.dims[0];
+    }
+
+    // Throws if not all rows have been written
+    virtual void close() = 0;
+
+protected:
+    int32_t rows_;
+    int32_t cols_;
+    int32_t rows_written_;
+
+    virtual void write_rows(const Dtype* rows, int32_t nrows) = 0;
+};
+
+// PGM (Dtype = uint8_t) or PPM (Dtype = RgbPixel), binary or ASCII
+template <typename Dtype>
+class NetpbmScanlineReader : public ScanlineReader<Dtype>, public NetpbmIOBase
+{
+public:
+    NetpbmScanlineReader(const std::string& filename);
+
+protected:
+    void read_rows(Dtype* out, int32_t nrows) override;
+
+private:
+    std::ifstream stream_;
+    bool binary_;
+    std::vector<uint8_t> row_buf_;
+};
+
+// Binary PGM (Dtype = uint8_t) or PPM (Dtype = RgbPixel)
+template <typename Dtype>
+class NetpbmScanlineWriter : public ScanlineWriter<Dtype>
+{
+public:
+    NetpbmScanlineWriter(const std::string& filename,
+                         int32_t rows,
+                         int32_t cols);
+
+    ~NetpbmScanlineWriter();
+
+    void close() override;
+
+protected:
+    void write_rows(const Dtype* rows, int32_t nrows) override;
+
+private:
+    std::ofstream stream_;
+    std::vector<uint8_t> row_buf_;
+};
+
+using PgmScanlineReader = NetpbmScanlineReader<uint8_t>;
+using PpmScanlineReader = NetpbmScanlineReader<RgbPixel>;
+using PgmScanlineWriter = NetpbmScanlineWriter<uint8_t>;
+using PpmScanlineWriter = NetpbmScanlineWriter<RgbPixel>;
+
+// 8-bit grayscale BMP, like BmpIO. Rows are fetched by seeking, so bottom-up
+// files still stream in constant memory
+class BmpScanlineReader : public ScanlineReader<uint8_t>
+{
+public:
+    BmpScanlineReader(const std::string& filename);
+
+protected:
+    void read_rows(uint8_t* out, int32_t nrows) override;
+
+private:
+    std::ifstream stream_;
+    std::streamoff data_offset_;
+    int32_t padded_row_size_;
+    bool bottom_up_;
+};
+
+class BmpScanlineWriter : public ScanlineWriter<uint8_t>
+{
+public:
+    BmpScanlineWriter(const std::string& filename, int32_t rows, int32_t cols);
+
+    ~BmpScanlineWriter();
+
+    void close() override;
+
+protected:
+    void write_rows(const uint8_t* rows, int32_t nrows) override;
+
+private:
+    std::ofstream stream_;
+    std::streamoff data_offset_;
+    int32_t padded_row_size_;
+};
+
+// RGB PNG. lodepng can only inflate a whole zlib stream at once, so this
+// holds the decoded image as packed RGB bytes (3 bytes/pixel, a fraction of a
+// MatrixX<RgbPixel>) and hands out rows from that
+class PngScanlineReader : public ScanlineReader<RgbPixel>
+{
+public:
+    PngScanlineReader(const std::string& filename);
+
+protected:
+    void read_rows(RgbPixel* out, int32_t nrows) override;
+
+private:
+    std::vector<uint8_t> pixels_;
+};
+
+// RGB PNG, written in constant memory: rows are filtered as they arrive and
+// each band of them is deflated and written out as its own IDAT chunk. Throws
+// for empty images, which PNG can't store
+class PngScanlineWriter : public ScanlineWriter<RgbPixel>
+{
+public:
+    PngScanlineWriter(const std::string& filename, int32_t rows, int32_t cols);
+
+    ~PngScanlineWriter();
+
+    void close() override;
+
+protected:
+    void write_rows(const RgbPixel* rows, int32_t nrows) override;
+
+private:
+    std::ofstream stream_;
+    std::vector<uint8_t> prev_row_;
+    std::vector<uint8_t> cur_row_;
+    std::vector<uint8_t> filtered_;
+    std::vector<uint8_t> pending_;
+    unsigned adler_;
+    bool started_;
+
+    void flush_band(bool final);
+};
+}
+
+#endif
@@ -0,0 +1,194 @@
+#pragma once
+
+#ifndef SIPL_MATRIX_STACKSTATISTICS_H
+#define SIPL_MATRIX_STACKSTATISTICS_H
+
+#include "Parallel.hpp"
+#include "matrix/Matrix"
+#include "matrix/Vector"
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
+
+namespace sipl
+{
+
+// Which statistics stack_statistics should compute (or'd together)
+enum StackStatistic : uint32_t {
+    STACK_MEAN = 1 << 0,
+    STACK_VARIANCE = 1 << 1,
+    STACK_MEDIAN = 1 << 2,
+    STACK_MODE = 1 << 3,
+    STACK_ALL = STACK_MEAN | STACK_VARIANCE | STACK_MEDIAN | STACK_MODE,
+};
+
+namespace impl
+{
+
+// Uniform per-channel access to scalar (uint8_t) and vector (e.g. RgbPixel)
+// pixels
+template <typename Dtype>
+struct PixelChannels {
+    static constexpr int32_t count = 1;
+    using channel_type = Dtype;
+    using double_type = double;
+
+    static uint8_t get(const Dtype& p, int32_t) { return p; }
+    static void set(Dtype& p, int32_t, uint8_t v) { p = v; }
+    static void set(double& p, int32_t, double v) { p = v; }
+};
+
+template <typename Dtype, int32_t Length>
+struct PixelChannels<Vector<Dtype, Length>> {
+    static constexpr int32_t count = Length;
+    using channel_type = Dtype;
+    using double_type = Vector<double, Length>;
+
+    static uint8_t get(const Vector<Dtype, Length>& p, int32_t c)
+    {
+        return p[c];
+    }
+    static void set(Vector<Dtype, Length>& p, int32_t c, uint8_t v)
+    {
+        p[c] = v;
+    }
+    static void set(double_type& p, int32_t c, double v) { p[c] = v; }
+};
+}
+
+// Per-pixel statistics over a stack of frames. Means and variances are per
+// channel doubles; medians and modes have the frames' own pixel type. Only the
+// ones requested are allocated
+template <typename Dtype>
+struct StackStatistics {
+    using DoubleType = typename impl::PixelChannels<Dtype>::double_type;
+
+    MatrixX<DoubleType> mean;
+    MatrixX<DoubleType> variance;
+    MatrixX<Dtype> median;
+    MatrixX<Dtype> mode;
+
+    StackStatistics() : mean(0, 0), variance(0, 0), median(0, 0), mode(0, 0)
+    {
+    }
+};
+
+// Computes the requested statistics of a stack of 8-bit frames (uint8_t or
+// vectors of uint8_t such as RgbPixel) in a single pass over the data. Pixels
+// are processed in tiles small enough for their sums and histograms to stay
+// in cache, with tiles spread across nthreads threads (<= 0: one per core).
+// The median is the upper one for even stack sizes (like nth_element at
+// size / 2); the mode breaks ties towards the smallest value. The variance
+// is the population variance
+template <typename Dtype>
+StackStatistics<Dtype> stack_statistics(
+    const std::vector<MatrixX<Dtype>>& frames,
+    uint32_t which = STACK_ALL,
+    int32_t nthreads = 0)
+{
+    using Channels = impl::PixelChannels<Dtype>;
+    static_assert(
+        std::is_same<typename Channels::channel_type, uint8_t>::value,
+        "stack_statistics needs 8-bit channels");
+    constexpr int32_t C = Channels::count;
+    constexpr int32_t TILE = 64;
+    assert(!frames.empty() && "no frames");
+
+    const auto dims = frames[0].dims;
+    const int32_t n = frames[0].size();
+    const bool want_moments = which & (STACK_MEAN | STACK_VARIANCE);
+    const bool want_hist = which & (STACK_MEDIAN | STACK_MODE);
+
+    StackStatistics<Dtype> stats;
+    if (which & STACK_MEAN) {
+        stats.mean = MatrixX<typename StackStatistics<Dtype>::DoubleType>(dims);
+    }
+    if (which & STACK_VARIANCE) {
+        stats.variance =
+            MatrixX<typename StackStatistics<Dtype>::DoubleType>(dims);
+    }
+    if (which & STACK_MEDIAN) {
+        stats.median = MatrixX<Dtype>(dims);
+    }
+    if (which & STACK_MODE) {
+        stats.mode = MatrixX<Dtype>(dims);
+    }
+
+    const double inv_count = 1.0 / double(frames.size());
+    const uint32_t rank = uint32_t(frames.size() / 2);
+    const int32_t ntiles = (n + TILE - 1) / TILE;
+    auto process_tiles = [&](int32_t tile_begin, int32_t tile_end) {
+        std::vector<uint64_t> sum(want_moments ? TILE * C : 0);
+        std::vector<uint64_t> sumsq(want_moments ? TILE * C : 0);
+        std::vector<uint32_t> hist(want_hist ? TILE * C * 256 : 0);
+
+        for (int32_t t = tile_begin; t < tile_end; ++t) {
+            const int32_t b = t * TILE;
+            const int32_t e = std::min(b + TILE, n);
+            std::fill(std::begin(sum), std::end(sum), 0);
+            std::fill(std::begin(sumsq), std::end(sumsq), 0);
+            std::fill(std::begin(hist), std::end(hist), 0);
+
+            // The one pass over the stack
+            for (const auto& f : frames) {
+                assert(f.dims == dims && "size mismatch");
+                for (int32_t i = b; i < e; ++i) {
+                    for (int32_t c = 0; c < C; ++c) {
+                        const uint32_t v = Channels::get(f[i], c);
+                        const size_t k = size_t(i - b) * C + size_t(c);
+                        if (want_moments) {
+                            sum[k] += v;
+                            sumsq[k] += v * v;
+                        }
+                        if (want_hist) {
+                            hist[k * 256 + v]++;
+                        }
+                    }
+                }
+            }
+
+            for (int32_t i = b; i < e; ++i) {
+                for (int32_t c = 0; c < C; ++c) {
+                    const size_t k = size_t(i - b) * C + size_t(c);
+                    const double mean = double(sum.empty() ? 0 : sum[k]) *
+                                        inv_count;
+                    if (which & STACK_MEAN) {
+                        Channels::set(stats.mean[i], c, mean);
+                    }
+                    if (which & STACK_VARIANCE) {
+                        Channels::set(
+                            stats.variance[i], c,
+                            std::max(0.0, double(sumsq[k]) * inv_count -
+                                              mean * mean));
+                    }
+                    if (!want_hist) {
+                        continue;
+                    }
+
+                    const uint32_t* h = &hist[k * 256];
+                    if (which & STACK_MEDIAN) {
+                        uint32_t seen = 0;
+                        int32_t v = 0;
+                        while (seen + h[v] <= rank) {
+                            seen += h[v++];
+                        }
+                        Channels::set(stats.median[i], c, uint8_t(v));
+                    }
+                    if (which & STACK_MODE) {
+                        Channels::set(
+                            stats.mode[i], c,
+                            uint8_t(std::max_element(h, h + 256) - h));
+                    }
+                }
+            }
+        }
+    };
+    parallel_for(0, ntiles, process_tiles, nthreads, 4);
+
+    return stats;
+}
+}
+
+#endif
@@ -5,43 +5,184 @@
 
 #include "improc/Histogram.hpp"
 #include "matrix/Matrix"
+#include "matrix/StackStatistics.hpp"
+#include "matrix/TemporalMedian.hpp"
 #include <algorithm>
+#include <cassert>
+#include <type_traits>
 #include <vector>
 
 namespace sipl
 {
 
+// Per-pixel, per-channel mode of a stack of 8-bit frames
 template <typename Dtype>
 MatrixX<Dtype> mode(const std::vector<MatrixX<Dtype>>& mats)
 {
-    MatrixX<Dtype> mat(mats[0].dims);
-    Dtype d;
-    Vector<size_t, 256> hist(size_t(0));
-    for (int32_t i = 0; i < mats[0].size(); ++i) {
-        for (int32_t c = 0; c < 2; ++c) {
-
-            // Calculate histogram
-            for (auto m : mats) {
-                hist[m[i][c]]++;
+    return stack_statistics(mats, STACK_MODE).mode;
+}
+
+// Per-pixel background estimate built up one frame at a time, so only the
+// accumulators (not the whole frame sequence) are kept in memory. MEAN is the
+// plain average of every frame seen, EMA an exponential moving average where
+// each frame moves the background alpha of the way towards it. Optionally
+// also tracks the per-pixel variance around that background
+template <typename Dtype>
+class BackgroundModel
+{
+    static_assert(std::is_arithmetic<Dtype>::value,
+                  "BackgroundModel needs scalar pixels");
+
+    // Integer frames are summed exactly
+    using Accumulator = std::conditional_t<std::is_integral<Dtype>::value,
+                                           int64_t,
+                                           double>;
+
+public:
+    enum class Method { MEAN, EMA };
+
+    BackgroundModel(Method method = Method::MEAN,
+                    double alpha = 0.05,
+                    bool track_variance = false)
+        : method_(method)
+        , alpha_(alpha)
+        , track_variance_(track_variance)
+        , count_(0)
+        , dims_{{0, 0}}
+        , sum_(0, 0)
+        , mean_(0, 0)
+        , var_(0, 0)
+    {
+        assert(alpha > 0 && alpha <= 1 && "alpha must be in (0, 1]");
+    }
+
+    int64_t count() const { return count_; }
+
+    void update(const MatrixX<Dtype>& frame)
+    {
+        if (count_ == 0) {
+            init(frame.dims);
+        }
+        assert(frame.dims == dims_ && "size mismatch");
+        ++count_;
+
+        const Dtype* px = frame.data();
+        const int32_t n = frame.size();
+        if (method_ == Method::MEAN) {
+            Accumulator* sum = sum_.data();
+            for (int32_t i = 0; i < n; ++i) {
+                sum[i] += Accumulator(px[i]);
             }
-            d[c] = hist.argmax();
+            if (track_variance_) {
+                // Welford's update: a running mean and sum of squared
+                // deviations, which don't cancel the way sum(x^2) - n * mean^2
+                // does for float frames
+                double* mean = mean_.data();
+                double* m2 = var_.data();
+                const double inv_count = 1.0 / double(count_);
+                for (int32_t i = 0; i < n; ++i) {
+                    const double x = double(px[i]);
+                    const double diff = x - mean[i];
+                    mean[i] += diff * inv_count;
+                    m2[i] += diff * (x - mean[i]);
+                }
+            }
+        } else if (count_ == 1) {
+            // Seed with the first frame rather than decaying up from 0
+            double* mean = mean_.data();
+            for (int32_t i = 0; i < n; ++i) {
+                mean[i] = double(px[i]);
+            }
+        } else {
+            double* mean = mean_.data();
+            if (track_variance_) {
+                double* var = var_.data();
+                for (int32_t i = 0; i < n; ++i) {
+                    const double diff = double(px[i]) - mean[i];
+                    const double incr = alpha_ * diff;
+                    mean[i] += incr;
+                    var[i] = (1 - alpha_) * (var[i] + diff * incr);
+                }
+            } else {
+                for (int32_t i = 0; i < n; ++i) {
+                    mean[i] += alpha_ * (double(px[i]) - mean[i]);
+                }
+            }
+        }
+    }
+
+    // Both are empty until the first update()
+    MatrixXd background() const
+    {
+        if (count_ == 0) {
+            return MatrixXd(0, 0);
+        }
+        if (method_ == Method::EMA) {
+            return mean_;
+        }
+        MatrixXd bg(dims_);
+        const double inv_count = 1.0 / double(count_);
+        for (int32_t i = 0; i < bg.size(); ++i) {
+            bg[i] = double(sum_[i]) * inv_count;
         }
+        return bg;
+    }
 
-        mat[i] = d;
-        hist.fill(0);
+    // Only available when constructed with track_variance
+    MatrixXd variance() const
+    {
+        assert(track_variance_ && "variance isn't being tracked");
+        if (count_ == 0) {
+            return MatrixXd(0, 0);
+        }
+        if (method_ == Method::EMA) {
+            return var_;
+        }
+        MatrixXd var(dims_);
+        const double inv_count = 1.0 / double(count_);
+        for (int32_t i = 0; i < var.size(); ++i) {
+            var[i] = var_[i] * inv_count;
+        }
+        return var;
     }
 
-    return mat;
-}
+private:
+    Method method_;
+    double alpha_;
+    bool track_variance_;
+    int64_t count_;
+    std::array<int32_t, 2> dims_;
+
+    // Only the accumulators for method_ are allocated. For MEAN with
+    // variance, mean_ and var_ hold Welford's running mean and sum of
+    // squared deviations; the background still comes from the exact sum_
+    MatrixX<Accumulator> sum_;
+    MatrixXd mean_;
+    MatrixXd var_;
+
+    void init(const std::array<int32_t, 2>& dims)
+    {
+        dims_ = dims;
+        if (method_ == Method::MEAN) {
+            sum_ = MatrixX<Accumulator>(dims, Accumulator(0));
+        }
+        if (method_ == Method::EMA || track_variance_) {
+            mean_ = MatrixXd(dims, 0.0);
+        }
+        if (track_variance_) {
+            var_ = MatrixXd(dims, 0.0);
+        }
+    }
+};
 
 template <typename Dtype>
 MatrixXd average(const std::vector<MatrixX<Dtype>>& mats)
 {
-    MatrixXd init(mats[0].dims, 0.0);
-	for (const auto& m : mats) {
-		init = init + m;
-	}
-    return init / double(mats.size());
+    BackgroundModel<Dtype> model;
+    for (const auto& m : mats) {
+        model.update(m);
+    }
+    return model.background();
 }
 
 template <typename Dtype>
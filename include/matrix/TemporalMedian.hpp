@@ -0,0 +1,174 @@
+#pragma once
+
+#ifndef SIPL_MATRIX_TEMPORALMEDIAN_H
+#define SIPL_MATRIX_TEMPORALMEDIAN_H
+
+#include "Parallel.hpp"
+#include "matrix/Matrix"
+#include "matrix/StackStatistics.hpp"
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <vector>
+
+namespace sipl
+{
+
+// Per-pixel median over a stream of 8-bit frames, either over every frame
+// seen (window = 0) or over a sliding window of the last `window` frames.
+// Each pixel keeps a 256-bin count histogram plus its current median and the
+// number of values below it, so inserting or evicting a frame only nudges the
+// median a few bins instead of re-sorting the stack. Counts are single bytes
+// when the window is at most 255 frames and 16 bits otherwise, so the
+// histograms take 256 or 512 bytes per pixel (about 530 MB or 1 GB at
+// 1920 x 1080) on top of the window's frames. At most 65535 frames can be
+// counted at once. Pixels are split into row bands across nthreads threads
+// (<= 0: one per core)
+class TemporalMedian
+{
+public:
+    TemporalMedian(int32_t window = 0, int32_t nthreads = 0)
+        : window_(window)
+        , nthreads_(nthreads)
+        , count_(0)
+        , oldest_(0)
+        , dims_({0, 0})
+        , median_(0, 0)
+    {
+        assert(window >= 0 && window <= MAX_COUNT && "window out of range");
+    }
+
+    // Number of frames the median is currently taken over
+    int32_t count() const { return count_; }
+
+    void update(const MatrixXb& frame)
+    {
+        if (hist8_.empty() && hist16_.empty()) {
+            init(frame.dims);
+        }
+        assert(frame.dims == dims_ && "size mismatch");
+
+        // With a full window the oldest frame is swapped out for the new one
+        const uint8_t* evicted = nullptr;
+        if (window_ > 0 && count_ == window_) {
+            evicted = ring_[size_t(oldest_)].data();
+        } else {
+            assert(count_ < MAX_COUNT && "too many frames");
+            ++count_;
+        }
+
+        const uint8_t* added = frame.data();
+        const uint16_t rank = uint16_t(count_ / 2);
+        parallel_for(0, dims_[0],
+                     [&](int32_t row_begin, int32_t row_end) {
+                         const int32_t b = row_begin * dims_[1];
+                         const int32_t e = row_end * dims_[1];
+                         for (int32_t i = b; i < e; ++i) {
+                             const uint8_t* old =
+                                 evicted ? evicted + i : nullptr;
+                             if (hist8_.empty()) {
+                                 update_pixel(&hist16_[size_t(i) * 256], i,
+                                              added[i], old, rank);
+                             } else {
+                                 update_pixel(&hist8_[size_t(i) * 256], i,
+                                              added[i], old, rank);
+                             }
+                         }
+                     },
+                     nthreads_, MIN_BAND_ROWS);
+
+        if (window_ > 0) {
+            if (ring_.size() < size_t(window_)) {
+                ring_.push_back(frame);
+            } else {
+                std::copy(std::begin(frame), std::end(frame),
+                          std::begin(ring_[size_t(oldest_)]));
+                oldest_ = (oldest_ + 1) % window_;
+            }
+        }
+    }
+
+    MatrixXb median() const { return median_; }
+
+private:
+    static constexpr int32_t MAX_COUNT = 65535;
+    static constexpr int32_t MAX_BYTE_COUNT = 255;
+    static constexpr int32_t MIN_BAND_ROWS = 16;
+
+    int32_t window_;
+    int32_t nthreads_;
+    int32_t count_;
+    int32_t oldest_;
+    std::array<int32_t, 2> dims_;
+
+    // 256 counts per pixel in whichever width the window allows (only one is
+    // allocated), and the window's frames in arrival order starting at
+    // oldest_ (only when windowed)
+    std::vector<uint8_t> hist8_;
+    std::vector<uint16_t> hist16_;
+    std::vector<MatrixXb> ring_;
+
+    // Current median of each pixel and how many of its values are below it
+    MatrixXb median_;
+    std::vector<uint16_t> below_;
+
+    void init(const std::array<int32_t, 2>& dims)
+    {
+        dims_ = dims;
+        const size_t n = size_t(dims[0]) * size_t(dims[1]);
+        if (window_ > 0 && window_ <= MAX_BYTE_COUNT) {
+            hist8_.assign(n * 256, 0);
+        } else {
+            hist16_.assign(n * 256, 0);
+        }
+        below_.assign(n, 0);
+        median_ = MatrixXb(dims, 0);
+        if (window_ > 0) {
+            ring_.reserve(size_t(window_));
+        }
+    }
+
+    template <typename Count>
+    void update_pixel(Count* h,
+                      int32_t i,
+                      uint8_t added,
+                      const uint8_t* evicted,
+                      uint16_t rank)
+    {
+        int32_t m = median_[i];
+        int32_t below = below_[i];
+
+        // Evict first so a full window of byte counts never overflows
+        if (evicted) {
+            --h[*evicted];
+            below -= (*evicted < m);
+        }
+        ++h[added];
+        below += (added < m);
+
+        // Walk m until exactly `rank` values lie below it (the same upper
+        // median nth_element at size / 2 picks)
+        while (below > rank) {
+            --m;
+            below -= h[m];
+        }
+        while (below + h[m] <= rank) {
+            below += h[m];
+            ++m;
+        }
+
+        median_[i] = uint8_t(m);
+        below_[i] = uint16_t(below);
+    }
+};
+
+// Per-pixel median of a whole stack of 8-bit frames, with the work spread
+// across nthreads threads (<= 0: one per core)
+inline MatrixXb temporal_median(const std::vector<MatrixXb>& frames,
+                                int32_t nthreads = 0)
+{
+    return stack_statistics(frames, STACK_MEDIAN, nthreads).median;
+}
+}
+
+#endif
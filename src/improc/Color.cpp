@@ -0,0 +1,522 @@
+#include "improc/Color.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIPL_COLOR_SSE2
+#endif
+
+using namespace sipl;
+
+namespace
+{
+
+// out = saturate((wa * a + wb * (b - ob) + wc * (c - oc) + bias) >> shift).
+// Every linear conversion here is three of these, one per output channel
+struct LinearWeights {
+    int16_t wa, wb, wc;
+    int16_t ob, oc;
+    int32_t bias;
+    int32_t shift;
+};
+
+// Forward weights are Q15 (each row sums to 1 << 15, or 0 for chroma)
+constexpr int32_t Q15_HALF = 1 << 14;
+constexpr int32_t CHROMA_BIAS = (128 << 15) + Q15_HALF;
+constexpr LinearWeights TO_Y{9798, 19235, 3735, 0, 0, Q15_HALF, 15};
+constexpr LinearWeights TO_CB{-5529, -10855, 16384, 0, 0, CHROMA_BIAS, 15};
+constexpr LinearWeights TO_CR{16384, -13720, -2664, 0, 0, CHROMA_BIAS, 15};
+
+// Inverse weights are Q14 since they go past 1.0. Inputs are (Y, Cb, Cr)
+constexpr int32_t Q14_HALF = 1 << 13;
+constexpr LinearWeights TO_R{16384, 0, 22970, 128, 128, Q14_HALF, 14};
+constexpr LinearWeights TO_G{16384, -5638, -11700, 128, 128, Q14_HALF, 14};
+constexpr LinearWeights TO_B{16384, 29032, 0, 128, 128, Q14_HALF, 14};
+
+inline uint8_t saturate(int32_t v)
+{
+    return uint8_t(std::min(std::max(v, 0), 255));
+}
+
+void apply_linear(const LinearWeights& w,
+                  const uint8_t* a,
+                  const uint8_t* b,
+                  const uint8_t* c,
+                  uint8_t* out,
+                  int32_t n)
+{
+    int32_t i = 0;
+#ifdef SIPL_COLOR_SSE2
+    // 16 pixels at a time: widen to 16 bits, pair up (a, b) and (c, 0) so
+    // pmaddwd does the weighted sums in 32 bits, then shift and saturate
+    const __m128i zero = _mm_setzero_si128();
+    // Packed in unsigned arithmetic: shifting a negative weight is undefined
+    const __m128i w_ab = _mm_set1_epi32(int32_t(
+        uint32_t(uint16_t(w.wa)) | (uint32_t(uint16_t(w.wb)) << 16)));
+    const __m128i w_c = _mm_set1_epi32(int32_t(uint16_t(w.wc)));
+    const __m128i ob = _mm_set1_epi16(w.ob);
+    const __m128i oc = _mm_set1_epi16(w.oc);
+    const __m128i bias = _mm_set1_epi32(w.bias);
+    const __m128i shift = _mm_cvtsi32_si128(w.shift);
+
+    auto sum8 = [&](__m128i a16, __m128i b16, __m128i c16) {
+        __m128i lo = _mm_add_epi32(
+            _mm_madd_epi16(_mm_unpacklo_epi16(a16, b16), w_ab),
+            _mm_madd_epi16(_mm_unpacklo_epi16(c16, zero), w_c));
+        __m128i hi = _mm_add_epi32(
+            _mm_madd_epi16(_mm_unpackhi_epi16(a16, b16), w_ab),
+            _mm_madd_epi16(_mm_unpackhi_epi16(c16, zero), w_c));
+        lo = _mm_sra_epi32(_mm_add_epi32(lo, bias), shift);
+        hi = _mm_sra_epi32(_mm_add_epi32(hi, bias), shift);
+        return _mm_packs_epi32(lo, hi);
+    };
+
+    for (; i + 16 <= n; i += 16) {
+        const __m128i va = _mm_loadu_si128((const __m128i*)(a + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i vc = _mm_loadu_si128((const __m128i*)(c + i));
+        const __m128i b_lo = _mm_sub_epi16(_mm_unpacklo_epi8(vb, zero), ob);
+        const __m128i b_hi = _mm_sub_epi16(_mm_unpackhi_epi8(vb, zero), ob);
+        const __m128i c_lo = _mm_sub_epi16(_mm_unpacklo_epi8(vc, zero), oc);
+        const __m128i c_hi = _mm_sub_epi16(_mm_unpackhi_epi8(vc, zero), oc);
+        const __m128i lo = sum8(_mm_unpacklo_epi8(va, zero), b_lo, c_lo);
+        const __m128i hi = sum8(_mm_unpackhi_epi8(va, zero), b_hi, c_hi);
+        _mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; i < n; ++i) {
+        const int32_t acc = w.wa * a[i] + w.wb * (b[i] - w.ob) +
+                            w.wc * (c[i] - w.oc) + w.bias;
+        out[i] = saturate(acc >> w.shift);
+    }
+}
+
+#ifdef SIPL_COLOR_SSE2
+inline __m128i select(__m128i mask, __m128i a, __m128i b)
+{
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+
+// round(num * num_scale / (den * den_scale)) for 8 nonnegative 16-bit
+// numerators and denominators, half up. A zero denominator divides by 1.
+// Float is exact here: the scaled operands stay below 2^24 and every quotient
+// below 256 is either a multiple of 1/2 or at least 1/3060 from one, far
+// more than float's rounding error
+inline __m128i div_round(__m128i num,
+                         __m128i den,
+                         float num_scale,
+                         float den_scale)
+{
+    const __m128i zero = _mm_setzero_si128();
+    const auto quotient = [&](__m128i n, __m128i d) {
+        const __m128 q = _mm_div_ps(
+            _mm_mul_ps(_mm_cvtepi32_ps(n), _mm_set1_ps(num_scale)),
+            _mm_max_ps(_mm_mul_ps(_mm_cvtepi32_ps(d), _mm_set1_ps(den_scale)),
+                       _mm_set1_ps(1.0f)));
+        return _mm_cvttps_epi32(_mm_add_ps(q, _mm_set1_ps(0.5f)));
+    };
+    return _mm_packs_epi32(
+        quotient(_mm_unpacklo_epi16(num, zero), _mm_unpacklo_epi16(den, zero)),
+        quotient(_mm_unpackhi_epi16(num, zero), _mm_unpackhi_epi16(den, zero)));
+}
+
+// rgb_to_hsv on 8 pixels widened to 16 bits
+inline void hsv_block(__m128i r,
+                      __m128i g,
+                      __m128i b,
+                      __m128i max,
+                      __m128i diff,
+                      __m128i& h,
+                      __m128i& s)
+{
+    const __m128i diff2 = _mm_add_epi16(diff, diff);
+    const __m128i from_b =
+        _mm_add_epi16(_mm_add_epi16(diff2, diff2), _mm_sub_epi16(r, g));
+    const __m128i from_g = _mm_add_epi16(diff2, _mm_sub_epi16(b, r));
+    __m128i hue = select(_mm_cmpeq_epi16(max, r), _mm_sub_epi16(g, b),
+                         select(_mm_cmpeq_epi16(max, g), from_g, from_b));
+    hue = _mm_add_epi16(
+        hue, _mm_and_si128(_mm_cmplt_epi16(hue, _mm_setzero_si128()),
+                           _mm_add_epi16(diff2, _mm_add_epi16(diff2, diff2))));
+    h = _mm_and_si128(div_round(hue, diff, 256, 6), _mm_set1_epi16(0xff));
+    s = div_round(diff, max, 255, 1);
+}
+
+// floor(x / 255) for x < 65535
+inline __m128i div255(__m128i x)
+{
+    return _mm_mulhi_epu16(_mm_add_epi16(x, _mm_set1_epi16(1)),
+                           _mm_set1_epi16(257));
+}
+
+// floor((v * w + 32639) / 65280) for w <= 65280, the amount q and t in
+// hsv_to_rgb fall below v. Split as v * (w >> 8) * 256 + v * (w & 0xff) so
+// every step fits in 16 bits
+inline __m128i hsv_drop(__m128i v, __m128i w)
+{
+    const __m128i high = _mm_mullo_epi16(v, _mm_srli_epi16(w, 8));
+    const __m128i low =
+        _mm_mullo_epi16(v, _mm_and_si128(w, _mm_set1_epi16(0xff)));
+    const __m128i low_sum =
+        _mm_srli_epi16(_mm_avg_epu16(low, _mm_set1_epi16(32638)), 7);
+    return div255(_mm_add_epi16(high, low_sum));
+}
+
+// hsv_to_rgb on 8 pixels widened to 16 bits
+inline void rgb_block(__m128i h,
+                      __m128i s,
+                      __m128i v,
+                      __m128i& r,
+                      __m128i& g,
+                      __m128i& b)
+{
+    const __m128i h6 = _mm_mullo_epi16(h, _mm_set1_epi16(6));
+    const __m128i sector = _mm_srli_epi16(h6, 8);
+    const __m128i f = _mm_and_si128(h6, _mm_set1_epi16(0xff));
+    const __m128i p = div255(_mm_add_epi16(
+        _mm_mullo_epi16(v, _mm_sub_epi16(_mm_set1_epi16(255), s)),
+        _mm_set1_epi16(127)));
+    const __m128i q = _mm_sub_epi16(v, hsv_drop(v, _mm_mullo_epi16(s, f)));
+    const __m128i t = _mm_sub_epi16(
+        v, hsv_drop(v, _mm_mullo_epi16(
+                           s, _mm_sub_epi16(_mm_set1_epi16(256), f))));
+    __m128i in[6];
+    for (int32_t k = 0; k < 6; ++k) {
+        in[k] = _mm_cmpeq_epi16(sector, _mm_set1_epi16(int16_t(k)));
+    }
+    r = select(_mm_or_si128(in[0], in[5]), v,
+               select(in[1], q, select(in[4], t, p)));
+    g = select(in[0], t,
+               select(_mm_or_si128(in[1], in[2]), v, select(in[3], q, p)));
+    b = select(_mm_or_si128(in[0], in[1]), p,
+               select(in[2], t, select(in[5], q, v)));
+}
+#endif
+
+using PlanarKernel = void (*)(const uint8_t*,
+                              const uint8_t*,
+                              const uint8_t*,
+                              uint8_t*,
+                              uint8_t*,
+                              uint8_t*,
+                              int32_t);
+
+// Converts pixels that aren't stored as planes (packed bytes, RgbPixels) by
+// gathering them into small planar buffers for the planar kernels
+constexpr int32_t CHUNK = 256;
+
+template <typename Load, typename Store>
+void convert_chunked(int32_t begin,
+                     int32_t end,
+                     Load load,
+                     PlanarKernel kernel,
+                     Store store)
+{
+    uint8_t in[3][CHUNK];
+    uint8_t out[3][CHUNK];
+    for (int32_t b = begin; b < end; b += CHUNK) {
+        const int32_t len = std::min(CHUNK, end - b);
+        for (int32_t i = 0; i < len; ++i) {
+            load(b + i, in[0][i], in[1][i], in[2][i]);
+        }
+        kernel(in[0], in[1], in[2], out[0], out[1], out[2], len);
+        for (int32_t i = 0; i < len; ++i) {
+            store(b + i, out[0][i], out[1][i], out[2][i]);
+        }
+    }
+}
+
+void gray_kernel(const uint8_t* r,
+                 const uint8_t* g,
+                 const uint8_t* b,
+                 uint8_t* gray,
+                 uint8_t*,
+                 uint8_t*,
+                 int32_t n)
+{
+    rgb_to_gray(r, g, b, gray, n);
+}
+
+void convert_packed(const uint8_t* in,
+                    uint8_t* out,
+                    int32_t n,
+                    PlanarKernel kernel)
+{
+    convert_chunked(0, n,
+                    [in](int32_t i, uint8_t& c0, uint8_t& c1, uint8_t& c2) {
+                        c0 = in[3 * i];
+                        c1 = in[3 * i + 1];
+                        c2 = in[3 * i + 2];
+                    },
+                    kernel,
+                    [out](int32_t i, uint8_t c0, uint8_t c1, uint8_t c2) {
+                        out[3 * i] = c0;
+                        out[3 * i + 1] = c1;
+                        out[3 * i + 2] = c2;
+                    });
+}
+
+// Big enough images are split into bands of rows of at least this many pixels
+constexpr int32_t MIN_PARALLEL_PIXELS = 1 << 16;
+
+MatrixX<RgbPixel> convert_image(const MatrixX<RgbPixel>& img,
+                                int32_t nthreads,
+                                PlanarKernel kernel)
+{
+    MatrixX<RgbPixel> out(img.dims);
+    const int32_t cols = img.dims[1];
+    const int32_t min_rows =
+        std::max(1, MIN_PARALLEL_PIXELS / std::max(cols, 1));
+    parallel_for(
+        0, img.dims[0],
+        [&](int32_t row_begin, int32_t row_end) {
+            convert_chunked(
+                row_begin * cols, row_end * cols,
+                [&img](int32_t i, uint8_t& c0, uint8_t& c1, uint8_t& c2) {
+                    c0 = img[i][0];
+                    c1 = img[i][1];
+                    c2 = img[i][2];
+                },
+                kernel,
+                [&out](int32_t i, uint8_t c0, uint8_t c1, uint8_t c2) {
+                    out[i][0] = c0;
+                    out[i][1] = c1;
+                    out[i][2] = c2;
+                });
+        },
+        nthreads, min_rows);
+    return out;
+}
+}
+
+void sipl::rgb_to_gray(const uint8_t* r,
+                       const uint8_t* g,
+                       const uint8_t* b,
+                       uint8_t* gray,
+                       int32_t n)
+{
+    apply_linear(TO_Y, r, g, b, gray, n);
+}
+
+void sipl::rgb_to_ycbcr(const uint8_t* r,
+                        const uint8_t* g,
+                        const uint8_t* b,
+                        uint8_t* y,
+                        uint8_t* cb,
+                        uint8_t* cr,
+                        int32_t n)
+{
+    apply_linear(TO_Y, r, g, b, y, n);
+    apply_linear(TO_CB, r, g, b, cb, n);
+    apply_linear(TO_CR, r, g, b, cr, n);
+}
+
+void sipl::ycbcr_to_rgb(const uint8_t* y,
+                        const uint8_t* cb,
+                        const uint8_t* cr,
+                        uint8_t* r,
+                        uint8_t* g,
+                        uint8_t* b,
+                        int32_t n)
+{
+    apply_linear(TO_R, y, cb, cr, r, n);
+    apply_linear(TO_G, y, cb, cr, g, n);
+    apply_linear(TO_B, y, cb, cr, b, n);
+}
+
+void sipl::rgb_to_hsv(const uint8_t* r,
+                      const uint8_t* g,
+                      const uint8_t* b,
+                      uint8_t* h,
+                      uint8_t* s,
+                      uint8_t* v,
+                      int32_t n)
+{
+    int32_t i = 0;
+#ifdef SIPL_COLOR_SSE2
+    // 16 pixels at a time: max, min and the hue numerator in 8-bit and
+    // 16-bit lanes, the two divisions in float
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const __m128i vr = _mm_loadu_si128((const __m128i*)(r + i));
+        const __m128i vg = _mm_loadu_si128((const __m128i*)(g + i));
+        const __m128i vb = _mm_loadu_si128((const __m128i*)(b + i));
+        const __m128i max = _mm_max_epu8(_mm_max_epu8(vr, vg), vb);
+        const __m128i diff =
+            _mm_sub_epi8(max, _mm_min_epu8(_mm_min_epu8(vr, vg), vb));
+        __m128i h_lo, s_lo, h_hi, s_hi;
+        hsv_block(_mm_unpacklo_epi8(vr, zero), _mm_unpacklo_epi8(vg, zero),
+                  _mm_unpacklo_epi8(vb, zero), _mm_unpacklo_epi8(max, zero),
+                  _mm_unpacklo_epi8(diff, zero), h_lo, s_lo);
+        hsv_block(_mm_unpackhi_epi8(vr, zero), _mm_unpackhi_epi8(vg, zero),
+                  _mm_unpackhi_epi8(vb, zero), _mm_unpackhi_epi8(max, zero),
+                  _mm_unpackhi_epi8(diff, zero), h_hi, s_hi);
+        _mm_storeu_si128((__m128i*)(h + i), _mm_packus_epi16(h_lo, h_hi));
+        _mm_storeu_si128((__m128i*)(s + i), _mm_packus_epi16(s_lo, s_hi));
+        _mm_storeu_si128((__m128i*)(v + i), max);
+    }
+#endif
+    for (; i < n; ++i) {
+        const int32_t ri = r[i], gi = g[i], bi = b[i];
+        const int32_t max = std::max({ri, gi, bi});
+        const int32_t diff = max - std::min({ri, gi, bi});
+        v[i] = uint8_t(max);
+        if (diff == 0) {
+            h[i] = 0;
+            s[i] = 0;
+            continue;
+        }
+        s[i] = uint8_t((255 * diff + max / 2) / max);
+
+        // Hue in units of diff / 6 of the circle, from red towards green
+        int32_t hue;
+        if (max == ri) {
+            hue = gi - bi;
+        } else if (max == gi) {
+            hue = 2 * diff + bi - ri;
+        } else {
+            hue = 4 * diff + ri - gi;
+        }
+        if (hue < 0) {
+            hue += 6 * diff;
+        }
+        h[i] = uint8_t(((256 * hue + 3 * diff) / (6 * diff)) & 0xff);
+    }
+}
+
+void sipl::hsv_to_rgb(const uint8_t* h,
+                      const uint8_t* s,
+                      const uint8_t* v,
+                      uint8_t* r,
+                      uint8_t* g,
+                      uint8_t* b,
+                      int32_t n)
+{
+    int32_t i = 0;
+#ifdef SIPL_COLOR_SSE2
+    // 16 pixels at a time, computing all of p, q and t and picking by sector.
+    // The divisions by 255 and 65280 are exact multiply-shifts, so this
+    // matches the scalar loop bit for bit
+    const __m128i zero = _mm_setzero_si128();
+    for (; i + 16 <= n; i += 16) {
+        const __m128i vh = _mm_loadu_si128((const __m128i*)(h + i));
+        const __m128i vs = _mm_loadu_si128((const __m128i*)(s + i));
+        const __m128i vv = _mm_loadu_si128((const __m128i*)(v + i));
+        __m128i r_lo, g_lo, b_lo, r_hi, g_hi, b_hi;
+        rgb_block(_mm_unpacklo_epi8(vh, zero), _mm_unpacklo_epi8(vs, zero),
+                  _mm_unpacklo_epi8(vv, zero), r_lo, g_lo, b_lo);
+        rgb_block(_mm_unpackhi_epi8(vh, zero), _mm_unpackhi_epi8(vs, zero),
+                  _mm_unpackhi_epi8(vv, zero), r_hi, g_hi, b_hi);
+        _mm_storeu_si128((__m128i*)(r + i), _mm_packus_epi16(r_lo, r_hi));
+        _mm_storeu_si128((__m128i*)(g + i), _mm_packus_epi16(g_lo, g_hi));
+        _mm_storeu_si128((__m128i*)(b + i), _mm_packus_epi16(b_lo, b_hi));
+    }
+#endif
+    for (; i < n; ++i) {
+        const int32_t si = s[i], vi = v[i];
+        if (si == 0) {
+            r[i] = g[i] = b[i] = uint8_t(vi);
+            continue;
+        }
+
+        // Which sixth of the circle, and how far into it (out of 256)
+        const int32_t h6 = h[i] * 6;
+        const int32_t sector = h6 >> 8;
+        const int32_t f = h6 & 0xff;
+        const auto p = uint8_t((vi * (255 - si) + 127) / 255);
+        const auto q = uint8_t((vi * (255 * 256 - si * f) + 32640) / 65280);
+        const auto t =
+            uint8_t((vi * (255 * 256 - si * (256 - f)) + 32640) / 65280);
+        const auto vb = uint8_t(vi);
+        const uint8_t rgb[6][3] = {{vb, t, p}, {q, vb, p}, {p, vb, t},
+                                   {p, q, vb}, {t, p, vb}, {vb, p, q}};
+        r[i] = rgb[sector][0];
+        g[i] = rgb[sector][1];
+        b[i] = rgb[sector][2];
+    }
+}
+
+void sipl::rgb_to_gray_packed(const uint8_t* rgb, uint8_t* gray, int32_t n)
+{
+    convert_chunked(0, n,
+                    [rgb](int32_t i, uint8_t& r, uint8_t& g, uint8_t& b) {
+                        r = rgb[3 * i];
+                        g = rgb[3 * i + 1];
+                        b = rgb[3 * i + 2];
+                    },
+                    gray_kernel,
+                    [gray](int32_t i, uint8_t y, uint8_t, uint8_t) {
+                        gray[i] = y;
+                    });
+}
+
+void sipl::rgb_to_ycbcr_packed(const uint8_t* rgb, uint8_t* ycbcr, int32_t n)
+{
+    convert_packed(rgb, ycbcr, n, rgb_to_ycbcr);
+}
+
+void sipl::ycbcr_to_rgb_packed(const uint8_t* ycbcr, uint8_t* rgb, int32_t n)
+{
+    convert_packed(ycbcr, rgb, n, ycbcr_to_rgb);
+}
+
+void sipl::rgb_to_hsv_packed(const uint8_t* rgb, uint8_t* hsv, int32_t n)
+{
+    convert_packed(rgb, hsv, n, rgb_to_hsv);
+}
+
+void sipl::hsv_to_rgb_packed(const uint8_t* hsv, uint8_t* rgb, int32_t n)
+{
+    convert_packed(hsv, rgb, n, hsv_to_rgb);
+}
+
+MatrixXb sipl::rgb_to_gray(const MatrixX<RgbPixel>& img, int32_t nthreads)
+{
+    MatrixXb gray(img.dims);
+    const int32_t cols = img.dims[1];
+    const int32_t min_rows =
+        std::max(1, MIN_PARALLEL_PIXELS / std::max(cols, 1));
+    parallel_for(
+        0, img.dims[0],
+        [&](int32_t row_begin, int32_t row_end) {
+            convert_chunked(
+                row_begin * cols, row_end * cols,
+                [&img](int32_t i, uint8_t& r, uint8_t& g, uint8_t& b) {
+                    r = img[i][0];
+                    g = img[i][1];
+                    b = img[i][2];
+                },
+                gray_kernel,
+                [&gray](int32_t i, uint8_t y, uint8_t, uint8_t) {
+                    gray[i] = y;
+                });
+        },
+        nthreads, min_rows);
+    return gray;
+}
+
+MatrixX<RgbPixel> sipl::rgb_to_ycbcr(const MatrixX<RgbPixel>& img,
+                                     int32_t nthreads)
+{
+    return convert_image(img, nthreads, sipl::rgb_to_ycbcr);
+}
+
+MatrixX<RgbPixel> sipl::ycbcr_to_rgb(const MatrixX<RgbPixel>& img,
+                                     int32_t nthreads)
+{
+    return convert_image(img, nthreads, sipl::ycbcr_to_rgb);
+}
+
+MatrixX<RgbPixel> sipl::rgb_to_hsv(const MatrixX<RgbPixel>& img,
+                                   int32_t nthreads)
+{
+    return convert_image(img, nthreads, sipl::rgb_to_hsv);
+}
+
+MatrixX<RgbPixel> sipl::hsv_to_rgb(const MatrixX<RgbPixel>& img,
+                                   int32_t nthreads)
+{
+    return convert_image(img, nthreads, sipl::hsv_to_rgb);
+}
@@ -0,0 +1,281 @@
+#include "improc/Interpolate.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIPL_INTERPOLATE_SSE2
+#endif
+
+using namespace sipl;
+
+namespace
+{
+
+// All four bilinear neighbors of (x, y) are inside a rows x cols image.
+// Written so NaNs fail
+inline bool inside(double x, double y, int32_t rows, int32_t cols)
+{
+    return x >= 0 && x < cols - 1 && y >= 0 && y < rows - 1;
+}
+
+// Top left neighbor of (x, y) as an index into a row-major image, and the
+// right/bottom weights in 1/256ths. (x, y) must be inside
+inline void to_fixed(double x,
+                     double y,
+                     int32_t stride,
+                     int32_t& offset,
+                     int32_t& wx,
+                     int32_t& wy)
+{
+    const auto x1 = int32_t(x);
+    const auto y1 = int32_t(y);
+    offset = y1 * stride + x1;
+    wx = int32_t((x - x1) * 256 + 0.5);
+    wy = int32_t((y - y1) * 256 + 0.5);
+}
+
+// 16-bit pixels need finer weights to stay within 1 level, so they use
+// 1/65536ths and do the vertical blend in 64 bits
+inline uint16_t blend_q16(uint32_t p00,
+                          uint32_t p01,
+                          uint32_t p10,
+                          uint32_t p11,
+                          uint32_t wx,
+                          uint32_t wy)
+{
+    const uint64_t top = uint64_t(p00) * (65536 - wx) + uint64_t(p01) * wx;
+    const uint64_t bottom = uint64_t(p10) * (65536 - wx) + uint64_t(p11) * wx;
+    return uint16_t((top * (65536 - wy) + bottom * wy + (1ull << 31)) >> 32);
+}
+
+bool block_inside(const double* xs,
+                  const double* ys,
+                  int32_t rows,
+                  int32_t cols)
+{
+    bool all = true;
+    for (int32_t k = 0; k < impl::SPAN_BLOCK; ++k) {
+        all &= inside(xs[k], ys[k], rows, cols);
+    }
+    return all;
+}
+
+#ifdef SIPL_INTERPOLATE_SSE2
+// Pairing (p00, p01) with (256 - wx, wx) lets pmaddwd do each weighted sum
+// in one instruction
+inline __m128i lerp_halves(__m128i a, __m128i b, __m128i w0, __m128i w1)
+{
+    const __m128i one = _mm_set1_epi32(1);
+    const __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(a, b),
+                                      _mm_unpacklo_epi16(w0, w1));
+    const __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(a, b),
+                                      _mm_unpackhi_epi16(w0, w1));
+    return _mm_packs_epi32(_mm_srai_epi32(_mm_add_epi32(lo, one), 1),
+                           _mm_srai_epi32(_mm_add_epi32(hi, one), 1));
+}
+#endif
+
+// Per-pixel path: bounds check, then blend(img, x, y) or fill_value
+template <typename Dtype, typename Blend>
+void span_border(const MatrixX<Dtype>& img,
+                 const double* xs,
+                 const double* ys,
+                 int32_t n,
+                 Dtype* out,
+                 const Dtype& fill_value,
+                 Blend blend)
+{
+    for (int32_t k = 0; k < n; ++k) {
+        if (inside(xs[k], ys[k], img.dims[0], img.dims[1])) {
+            out[k] = blend(xs[k], ys[k]);
+        } else {
+            out[k] = fill_value;
+        }
+    }
+}
+}
+
+void sipl::impl::blend_block(const Corners& c,
+                             const int16_t* wx,
+                             const int16_t* wy,
+                             uint8_t* out)
+{
+#ifdef SIPL_INTERPOLATE_SSE2
+    const __m128i full = _mm_set1_epi16(256);
+    const __m128i round = _mm_set1_epi32(1 << 14);
+    const __m128i wx1 = _mm_load_si128(reinterpret_cast<const __m128i*>(wx));
+    const __m128i wy1 = _mm_load_si128(reinterpret_cast<const __m128i*>(wy));
+    const __m128i wx0 = _mm_sub_epi16(full, wx1);
+    const __m128i wy0 = _mm_sub_epi16(full, wy1);
+
+    const auto load = [](const int16_t* p) {
+        return _mm_load_si128(reinterpret_cast<const __m128i*>(p));
+    };
+    const __m128i top = lerp_halves(load(c.p00), load(c.p01), wx0, wx1);
+    const __m128i bottom = lerp_halves(load(c.p10), load(c.p11), wx0, wx1);
+
+    __m128i lo = _mm_madd_epi16(_mm_unpacklo_epi16(top, bottom),
+                                _mm_unpacklo_epi16(wy0, wy1));
+    __m128i hi = _mm_madd_epi16(_mm_unpackhi_epi16(top, bottom),
+                                _mm_unpackhi_epi16(wy0, wy1));
+    lo = _mm_srai_epi32(_mm_add_epi32(lo, round), 15);
+    hi = _mm_srai_epi32(_mm_add_epi32(hi, round), 15);
+    const __m128i words = _mm_packs_epi32(lo, hi);
+    _mm_storel_epi64(reinterpret_cast<__m128i*>(out),
+                     _mm_packus_epi16(words, words));
+#else
+    for (int32_t k = 0; k < SPAN_BLOCK; ++k) {
+        out[k] = blend_q8(c.p00[k], c.p01[k], c.p10[k], c.p11[k], wx[k],
+                          wy[k]);
+    }
+#endif
+}
+
+void sipl::bilinear_span(const MatrixXb& img,
+                         const double* xs,
+                         const double* ys,
+                         int32_t n,
+                         uint8_t* out,
+                         uint8_t fill_value)
+{
+    const uint8_t* src = img.data();
+    const int32_t stride = img.dims[1];
+    const auto blend = [src, stride](double x, double y) {
+        int32_t offset, wx, wy;
+        to_fixed(x, y, stride, offset, wx, wy);
+        const uint8_t* p = src + offset;
+        return impl::blend_q8(p[0], p[1], p[stride], p[stride + 1], wx, wy);
+    };
+
+    int32_t k = 0;
+#ifdef SIPL_INTERPOLATE_SSE2
+    impl::Corners c;
+    alignas(16) int16_t wx[impl::SPAN_BLOCK];
+    alignas(16) int16_t wy[impl::SPAN_BLOCK];
+    for (; k + impl::SPAN_BLOCK <= n; k += impl::SPAN_BLOCK) {
+        if (!block_inside(xs + k, ys + k, img.dims[0], img.dims[1])) {
+            span_border(img, xs + k, ys + k, impl::SPAN_BLOCK, out + k,
+                        fill_value, blend);
+            continue;
+        }
+        for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+            int32_t offset, x_weight, y_weight;
+            to_fixed(xs[k + q], ys[k + q], stride, offset, x_weight, y_weight);
+            const uint8_t* p = src + offset;
+            c.p00[q] = p[0];
+            c.p01[q] = p[1];
+            c.p10[q] = p[stride];
+            c.p11[q] = p[stride + 1];
+            wx[q] = int16_t(x_weight);
+            wy[q] = int16_t(y_weight);
+        }
+        blend_block(c, wx, wy, out + k);
+    }
+#endif
+    span_border(img, xs + k, ys + k, n - k, out + k, fill_value, blend);
+}
+
+void sipl::bilinear_span(const MatrixX<RgbPixel>& img,
+                         const double* xs,
+                         const double* ys,
+                         int32_t n,
+                         RgbPixel* out,
+                         const RgbPixel& fill_value)
+{
+    const RgbPixel* src = img.data();
+    const int32_t stride = img.dims[1];
+    const auto blend = [src, stride](double x, double y) {
+        int32_t offset, wx, wy;
+        to_fixed(x, y, stride, offset, wx, wy);
+        const RgbPixel* p = src + offset;
+        RgbPixel result;
+        for (int32_t c = 0; c < 3; ++c) {
+            result[c] = impl::blend_q8(p[0][c], p[1][c], p[stride][c],
+                                       p[stride + 1][c], wx, wy);
+        }
+        return result;
+    };
+
+    int32_t k = 0;
+#ifdef SIPL_INTERPOLATE_SSE2
+    impl::Corners c;
+    alignas(16) int16_t wx[impl::SPAN_BLOCK];
+    alignas(16) int16_t wy[impl::SPAN_BLOCK];
+    int32_t offsets[impl::SPAN_BLOCK];
+    uint8_t channel[impl::SPAN_BLOCK];
+    for (; k + impl::SPAN_BLOCK <= n; k += impl::SPAN_BLOCK) {
+        if (!block_inside(xs + k, ys + k, img.dims[0], img.dims[1])) {
+            span_border(img, xs + k, ys + k, impl::SPAN_BLOCK, out + k,
+                        fill_value, blend);
+            continue;
+        }
+        for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+            int32_t x_weight, y_weight;
+            to_fixed(xs[k + q], ys[k + q], stride, offsets[q], x_weight,
+                     y_weight);
+            wx[q] = int16_t(x_weight);
+            wy[q] = int16_t(y_weight);
+        }
+
+        // One pass of the kernel per channel
+        for (int32_t ch = 0; ch < 3; ++ch) {
+            for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+                const RgbPixel* p = src + offsets[q];
+                c.p00[q] = p[0][ch];
+                c.p01[q] = p[1][ch];
+                c.p10[q] = p[stride][ch];
+                c.p11[q] = p[stride + 1][ch];
+            }
+            blend_block(c, wx, wy, channel);
+            for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+                out[k + q][ch] = channel[q];
+            }
+        }
+    }
+#endif
+    span_border(img, xs + k, ys + k, n - k, out + k, fill_value, blend);
+}
+
+void sipl::bilinear_span(const MatrixX<uint16_t>& img,
+                         const double* xs,
+                         const double* ys,
+                         int32_t n,
+                         uint16_t* out,
+                         uint16_t fill_value)
+{
+    const uint16_t* src = img.data();
+    const int32_t stride = img.dims[1];
+    span_border(img, xs, ys, n, out, fill_value,
+                [src, stride](double x, double y) {
+                    const auto x1 = int32_t(x);
+                    const auto y1 = int32_t(y);
+                    const auto wx = uint32_t((x - x1) * 65536 + 0.5);
+                    const auto wy = uint32_t((y - y1) * 65536 + 0.5);
+                    const uint16_t* p = src + y1 * stride + x1;
+                    return blend_q16(p[0], p[1], p[stride], p[stride + 1], wx,
+                                     wy);
+                });
+}
+
+void sipl::bilinear_span(const MatrixX<float>& img,
+                         const double* xs,
+                         const double* ys,
+                         int32_t n,
+                         float* out,
+                         float fill_value)
+{
+    const float* src = img.data();
+    const int32_t stride = img.dims[1];
+    span_border(img, xs, ys, n, out, fill_value,
+                [src, stride](double x, double y) {
+                    const auto x1 = int32_t(x);
+                    const auto y1 = int32_t(y);
+                    const auto fx = float(x - x1);
+                    const auto fy = float(y - y1);
+                    const float* p = src + y1 * stride + x1;
+                    const float top = p[0] + fx * (p[1] - p[0]);
+                    const float bottom =
+                        p[stride] + fx * (p[stride + 1] - p[stride]);
+                    return top + fy * (bottom - top);
+                });
+}
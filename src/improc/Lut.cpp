@@ -0,0 +1,100 @@
+#include "improc/Lut.hpp"
+#include "Parallel.hpp"
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIPL_LUT_SSE2
+#endif
+
+using namespace sipl;
+
+namespace
+{
+
+// Below this many pixels a single thread is faster than spawning more
+constexpr int32_t MIN_PARALLEL_PIXELS = 1 << 18;
+}
+
+// A 256-byte table stays in L1, so the loads are cheap and the work is in
+// issuing them: four independent lookups per iteration keep the load ports
+// busy. (Splitting the table into 16 pshufb lookups measured ~2.5x slower than
+// this with SSSE3.)
+void sipl::lut_apply(const uint8_t* in,
+                     uint8_t* out,
+                     int32_t n,
+                     const LookupTable& table)
+{
+    const uint8_t* t = table.data();
+    int32_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        const uint8_t a = t[in[i]];
+        const uint8_t b = t[in[i + 1]];
+        const uint8_t c = t[in[i + 2]];
+        const uint8_t d = t[in[i + 3]];
+        out[i] = a;
+        out[i + 1] = b;
+        out[i + 2] = c;
+        out[i + 3] = d;
+    }
+    for (; i < n; ++i) {
+        out[i] = t[in[i]];
+    }
+}
+
+MatrixXb sipl::lut_apply(const MatrixXb& img,
+                         const LookupTable& table,
+                         int32_t nthreads)
+{
+    MatrixXb out(img.dims);
+    const uint8_t* in = img.data();
+    uint8_t* dst = out.data();
+    parallel_for(0, img.size(),
+                 [&](int32_t begin, int32_t end) {
+                     lut_apply(in + begin, dst + begin, end - begin, table);
+                 },
+                 nthreads, MIN_PARALLEL_PIXELS);
+    return out;
+}
+
+void sipl::impl::blend_luts(const LookupTable* a,
+                            const LookupTable* b,
+                            int32_t n,
+                            int32_t w,
+                            int16_t* out)
+{
+    for (int32_t t = 0; t < n; ++t) {
+        const uint8_t* pa = a[t].data();
+        const uint8_t* pb = b[t].data();
+        int16_t* dst = out + t * 256;
+        int32_t v = 0;
+#ifdef SIPL_LUT_SSE2
+        // Unsigned 16-bit lanes: at most 255 * 256 + 1 before the halving
+        const __m128i zero = _mm_setzero_si128();
+        const __m128i one = _mm_set1_epi16(1);
+        const __m128i wa = _mm_set1_epi16(int16_t(256 - w));
+        const __m128i wb = _mm_set1_epi16(int16_t(w));
+        const auto blend = [&](__m128i x, __m128i y) {
+            const __m128i sum = _mm_add_epi16(
+                _mm_add_epi16(_mm_mullo_epi16(x, wa), _mm_mullo_epi16(y, wb)),
+                one);
+            return _mm_srli_epi16(sum, 1);
+        };
+        for (; v < 256; v += 16) {
+            const __m128i x =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(pa + v));
+            const __m128i y =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(pb + v));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + v),
+                             blend(_mm_unpacklo_epi8(x, zero),
+                                   _mm_unpacklo_epi8(y, zero)));
+            _mm_storeu_si128(reinterpret_cast<__m128i*>(dst + v + 8),
+                             blend(_mm_unpackhi_epi8(x, zero),
+                                   _mm_unpackhi_epi8(y, zero)));
+        }
+#endif
+        for (; v < 256; ++v) {
+            dst[v] = int16_t((pa[v] * (256 - w) + pb[v] * w + 1) >> 1);
+        }
+    }
+}
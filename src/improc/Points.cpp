@@ -0,0 +1,87 @@
+#include "improc/Points.hpp"
+#include <algorithm>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIPL_POINTS_SSE2
+#endif
+
+using namespace sipl;
+
+namespace
+{
+
+// Points copied out of Vector2d's at a time, so the batch stays on the stack
+constexpr int32_t POINT_BATCH = 256;
+}
+
+void sipl::transform_points(const Matrix33d& m,
+                            const double* xs,
+                            const double* ys,
+                            int32_t n,
+                            double* out_xs,
+                            double* out_ys)
+{
+    const bool affine = m(2, 0) == 0 && m(2, 1) == 0 && m(2, 2) == 1;
+    int32_t k = 0;
+#ifdef SIPL_POINTS_SSE2
+    const auto coeff = [&m](int32_t r, int32_t c) {
+        return _mm_set1_pd(m(r, c));
+    };
+    const __m128d m00 = coeff(0, 0), m01 = coeff(0, 1), m02 = coeff(0, 2);
+    const __m128d m10 = coeff(1, 0), m11 = coeff(1, 1), m12 = coeff(1, 2);
+    const __m128d m20 = coeff(2, 0), m21 = coeff(2, 1), m22 = coeff(2, 2);
+    for (; k + 2 <= n; k += 2) {
+        const __m128d x = _mm_loadu_pd(xs + k);
+        const __m128d y = _mm_loadu_pd(ys + k);
+        __m128d u = _mm_add_pd(
+            _mm_add_pd(_mm_mul_pd(m00, x), _mm_mul_pd(m01, y)), m02);
+        __m128d v = _mm_add_pd(
+            _mm_add_pd(_mm_mul_pd(m10, x), _mm_mul_pd(m11, y)), m12);
+        if (!affine) {
+            const __m128d w = _mm_add_pd(
+                _mm_add_pd(_mm_mul_pd(m20, x), _mm_mul_pd(m21, y)), m22);
+            u = _mm_div_pd(u, w);
+            v = _mm_div_pd(v, w);
+        }
+        _mm_storeu_pd(out_xs + k, u);
+        _mm_storeu_pd(out_ys + k, v);
+    }
+#endif
+    for (; k < n; ++k) {
+        const double x = xs[k];
+        const double y = ys[k];
+        double u = m(0, 0) * x + m(0, 1) * y + m(0, 2);
+        double v = m(1, 0) * x + m(1, 1) * y + m(1, 2);
+        if (!affine) {
+            const double w = m(2, 0) * x + m(2, 1) * y + m(2, 2);
+            u /= w;
+            v /= w;
+        }
+        out_xs[k] = u;
+        out_ys[k] = v;
+    }
+}
+
+void sipl::transform_points(const Matrix33d& m,
+                            const std::vector<Vector2d>& points,
+                            std::vector<Vector2d>& out)
+{
+    const auto n = int32_t(points.size());
+    out.resize(points.size());
+    double xs[POINT_BATCH];
+    double ys[POINT_BATCH];
+    for (int32_t b = 0; b < n; b += POINT_BATCH) {
+        const int32_t count = std::min(POINT_BATCH, n - b);
+        for (int32_t k = 0; k < count; ++k) {
+            xs[k] = points[size_t(b + k)][0];
+            ys[k] = points[size_t(b + k)][1];
+        }
+        transform_points(m, xs, ys, count, xs, ys);
+        for (int32_t k = 0; k < count; ++k) {
+            out[size_t(b + k)][0] = xs[k];
+            out[size_t(b + k)][1] = ys[k];
+        }
+    }
+}
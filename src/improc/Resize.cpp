@@ -0,0 +1,525 @@
+#include "improc/Resize.hpp"
+#include "improc/LanczosInterpolator.hpp"
+#include "Parallel.hpp"
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIPL_RESIZE_SSE2
+#endif
+
+using namespace sipl;
+
+namespace
+{
+
+// Output rows per thread below which splitting costs more than it saves
+constexpr int32_t MIN_ROWS_PER_THREAD = 8;
+
+// Resampling weights are Q14 and the vertical pass keeps 6 fractional bits,
+// so the horizontal sums stay well inside 32 bits even with Lanczos lobes
+constexpr int32_t WEIGHT_BITS = 14;
+constexpr int32_t MID_BITS = 6;
+
+inline uint8_t saturate(int32_t v)
+{
+    return uint8_t(std::min(std::max(v, 0), 255));
+}
+
+inline int32_t clamp_index(int32_t i, int32_t size)
+{
+    return std::min(std::max(i, 0), size - 1);
+}
+
+// acc[c] += row[c] for n columns
+void add_row(const uint8_t* row, uint32_t* acc, int32_t n)
+{
+    int32_t c = 0;
+#ifdef SIPL_RESIZE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; c + 16 <= n; c += 16) {
+        const __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(row + c));
+        const __m128i lo = _mm_unpacklo_epi8(v, zero);
+        const __m128i hi = _mm_unpackhi_epi8(v, zero);
+        const __m128i parts[4] = {
+            _mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero),
+            _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+        for (int32_t k = 0; k < 4; ++k) {
+            auto* dst = reinterpret_cast<__m128i*>(acc + c + 4 * k);
+            _mm_storeu_si128(dst,
+                             _mm_add_epi32(_mm_loadu_si128(dst), parts[k]));
+        }
+    }
+#endif
+    for (; c < n; ++c) {
+        acc[c] += row[c];
+    }
+}
+
+// out[c] = r0 + 4 r1 + 6 r2 + 4 r3 + r4, the vertical half of the binomial
+// filter
+void binomial5(const uint8_t* r0,
+               const uint8_t* r1,
+               const uint8_t* r2,
+               const uint8_t* r3,
+               const uint8_t* r4,
+               uint16_t* out,
+               int32_t n)
+{
+    int32_t c = 0;
+#ifdef SIPL_RESIZE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const auto load = [zero, &c](const uint8_t* row) {
+        return _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + c)), zero);
+    };
+    for (; c + 8 <= n; c += 8) {
+        const __m128i outer = _mm_add_epi16(load(r0), load(r4));
+        const __m128i inner = _mm_add_epi16(load(r1), load(r3));
+        const __m128i center = load(r2);
+        const __m128i sum = _mm_add_epi16(
+            _mm_add_epi16(outer, _mm_slli_epi16(inner, 2)),
+            _mm_add_epi16(_mm_slli_epi16(center, 2),
+                          _mm_slli_epi16(center, 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c), sum);
+    }
+#endif
+    for (; c < n; ++c) {
+        out[c] = uint16_t(r0[c] + 4 * r1[c] + 6 * r2[c] + 4 * r3[c] + r4[c]);
+    }
+}
+
+// Horizontal half of the binomial filter at the even columns of a row of
+// vertical sums v (< 2^12): dst[j] = (v[2j - 2] + 4 v[2j - 1] + 6 v[2j] +
+// 4 v[2j + 1] + v[2j + 2] + 128) >> 8, clamping at the edges
+void binomial5_even(const uint16_t* v, int32_t n, uint8_t* dst, int32_t out_n)
+{
+    if (n <= 0 || out_n <= 0) {
+        return;
+    }
+    const auto at = [v, n](int32_t k) { return int32_t(v[clamp_index(k, n)]); };
+    int32_t j = 0;
+#ifdef SIPL_RESIZE_SSE2
+    // Split 16 sums into even and odd lanes. The total stays below 2^16, so
+    // unsigned 16-bit lanes hold it
+    const auto split = [](const uint16_t* p, __m128i& even, __m128i& odd) {
+        const __m128i a = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 8));
+        even = _mm_packs_epi32(_mm_srai_epi32(_mm_slli_epi32(a, 16), 16),
+                               _mm_srai_epi32(_mm_slli_epi32(b, 16), 16));
+        odd = _mm_packs_epi32(_mm_srai_epi32(a, 16), _mm_srai_epi32(b, 16));
+    };
+    const __m128i round = _mm_set1_epi16(128);
+    for (j = std::min(out_n, 1); j < out_n && 2 * j + 18 <= n; j += 8) {
+        __m128i e0, o0, e1, o1, e2, o2;
+        split(v + 2 * j - 2, e0, o0);
+        split(v + 2 * j, e1, o1);
+        split(v + 2 * j + 2, e2, o2);
+        const __m128i inner = _mm_add_epi16(o0, o1);
+        const __m128i sum = _mm_add_epi16(
+            _mm_add_epi16(_mm_add_epi16(e0, e2), _mm_slli_epi16(inner, 2)),
+            _mm_add_epi16(
+                _mm_add_epi16(_mm_slli_epi16(e1, 2), _mm_slli_epi16(e1, 1)),
+                round));
+        const __m128i out = _mm_srli_epi16(sum, 8);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst + j),
+                         _mm_packus_epi16(out, out));
+    }
+    if (j > 0) {
+        dst[0] = uint8_t(
+            (at(-2) + 4 * at(-1) + 6 * at(0) + 4 * at(1) + at(2) + 128) >> 8);
+    }
+#endif
+    for (; j < out_n; ++j) {
+        const int32_t c = 2 * j;
+        dst[j] = uint8_t((at(c - 2) + 4 * at(c - 1) + 6 * at(c) +
+                          4 * at(c + 1) + at(c + 2) + 128) >>
+                         8);
+    }
+}
+
+// Vertical half of pyr_up: out[c] = r0 + 6 r1 + r2 at even output rows
+void binomial3(const uint8_t* r0,
+               const uint8_t* r1,
+               const uint8_t* r2,
+               uint16_t* out,
+               int32_t n)
+{
+    int32_t c = 0;
+#ifdef SIPL_RESIZE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    const auto load = [zero, &c](const uint8_t* row) {
+        return _mm_unpacklo_epi8(
+            _mm_loadl_epi64(reinterpret_cast<const __m128i*>(row + c)), zero);
+    };
+    for (; c + 8 <= n; c += 8) {
+        const __m128i center = load(r1);
+        const __m128i sum = _mm_add_epi16(
+            _mm_add_epi16(load(r0), load(r2)),
+            _mm_add_epi16(_mm_slli_epi16(center, 2),
+                          _mm_slli_epi16(center, 1)));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c), sum);
+    }
+#endif
+    for (; c < n; ++c) {
+        out[c] = uint16_t(r0[c] + 6 * r1[c] + r2[c]);
+    }
+}
+
+// Vertical half of pyr_up: out[c] = 4 (r0 + r1) at odd output rows
+void binomial2(const uint8_t* r0, const uint8_t* r1, uint16_t* out, int32_t n)
+{
+    int32_t c = 0;
+#ifdef SIPL_RESIZE_SSE2
+    const __m128i zero = _mm_setzero_si128();
+    for (; c + 16 <= n; c += 16) {
+        const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(r0 + c));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(r1 + c));
+        const __m128i lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero),
+                                         _mm_unpacklo_epi8(b, zero));
+        const __m128i hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero),
+                                         _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c),
+                         _mm_slli_epi16(lo, 2));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + c + 8),
+                         _mm_slli_epi16(hi, 2));
+    }
+#endif
+    for (; c < n; ++c) {
+        out[c] = uint16_t(4 * (r0[c] + r1[c]));
+    }
+}
+
+// Horizontal half of pyr_up from a row of vertical sums v (< 2^11):
+// dst[2j] = (v[j - 1] + 6 v[j] + v[j + 1] + 32) >> 6 and
+// dst[2j + 1] = (4 (v[j] + v[j + 1]) + 32) >> 6, clamping at the edges
+void upsample_row(const uint16_t* v, int32_t n, uint8_t* dst)
+{
+    if (n <= 0) {
+        return;
+    }
+    const auto at = [v, n](int32_t k) { return int32_t(v[clamp_index(k, n)]); };
+    const auto phases = [&](int32_t j) {
+        dst[2 * j] = uint8_t((at(j - 1) + 6 * at(j) + at(j + 1) + 32) >> 6);
+        dst[2 * j + 1] = uint8_t((4 * (at(j) + at(j + 1)) + 32) >> 6);
+    };
+    int32_t j = 0;
+#ifdef SIPL_RESIZE_SSE2
+    // Both phases of 8 source pixels, interleaved into 16 outputs. The sums
+    // stay below 2^15
+    const __m128i round = _mm_set1_epi16(32);
+    if (n >= 10) {
+        phases(j++);
+        for (; j + 9 <= n; j += 8) {
+            const __m128i left =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + j - 1));
+            const __m128i mid =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + j));
+            const __m128i right =
+                _mm_loadu_si128(reinterpret_cast<const __m128i*>(v + j + 1));
+            const __m128i even = _mm_srli_epi16(
+                _mm_add_epi16(
+                    _mm_add_epi16(left, right),
+                    _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(mid, 2),
+                                                _mm_slli_epi16(mid, 1)),
+                                  round)),
+                6);
+            const __m128i odd = _mm_srli_epi16(
+                _mm_add_epi16(_mm_slli_epi16(_mm_add_epi16(mid, right), 2),
+                              round),
+                6);
+            _mm_storeu_si128(
+                reinterpret_cast<__m128i*>(dst + 2 * j),
+                _mm_packus_epi16(_mm_unpacklo_epi16(even, odd),
+                                 _mm_unpackhi_epi16(even, odd)));
+        }
+    }
+#endif
+    for (; j < n; ++j) {
+        phases(j);
+    }
+}
+
+// Taps and weights along one axis: output o reads source
+// first[o] .. first[o] + taps - 1 with weights[o * taps ..]. Taps past the
+// edge are folded onto the edge pixel, so the window always lies inside
+struct AxisTable {
+    int32_t taps;
+    std::vector<int32_t> first;
+    std::vector<int16_t> weights;
+};
+
+AxisTable make_table(int32_t src, int32_t dst, ResizeMethod method)
+{
+    const double scale = double(src) / dst;
+
+    // Unnormalized weights per output, on unclamped source indices
+    std::vector<int32_t> starts(size_t(dst), 0);
+    std::vector<std::vector<double>> raw(static_cast<size_t>(dst));
+    for (int32_t o = 0; o < dst; ++o) {
+        auto& w = raw[size_t(o)];
+        if (method == ResizeMethod::AREA && scale >= 1) {
+            // Overlap of [o * scale, (o + 1) * scale) with each pixel
+            const double a = o * scale;
+            const double b = std::min((o + 1) * scale, double(src));
+            const auto s0 = int32_t(std::floor(a));
+            starts[size_t(o)] = s0;
+            for (int32_t s = s0; s < b; ++s) {
+                w.push_back(std::min(b, s + 1.0) - std::max(a, double(s)));
+            }
+        } else {
+            // Filters centered on the output pixel. Enlarging with AREA
+            // interpolates linearly, since each output covers under a pixel
+            const double center = (o + 0.5) * scale - 0.5;
+            const double stretch = std::max(scale, 1.0);
+            const double radius =
+                method == ResizeMethod::AREA ? 1 : 3 * stretch;
+            const auto s0 = int32_t(std::floor(center - radius)) + 1;
+            const auto s1 = int32_t(std::floor(center + radius));
+            starts[size_t(o)] = s0;
+            for (int32_t s = s0; s <= s1; ++s) {
+                const double x = (s - center) / stretch;
+                w.push_back(method == ResizeMethod::AREA
+                                ? std::max(0.0, 1 - std::abs(x))
+                                : impl::lanczos3(x));
+            }
+        }
+    }
+
+    AxisTable table;
+    table.taps = 1;
+    for (const auto& w : raw) {
+        table.taps = std::max(table.taps, int32_t(w.size()));
+    }
+    table.taps = std::min(table.taps, src);
+    table.first.resize(size_t(dst));
+    table.weights.assign(size_t(dst) * size_t(table.taps), 0);
+
+    std::vector<double> folded(size_t(table.taps));
+    for (int32_t o = 0; o < dst; ++o) {
+        const auto& w = raw[size_t(o)];
+        const int32_t s0 = starts[size_t(o)];
+        const int32_t first =
+            std::min(clamp_index(s0, src), src - table.taps);
+        table.first[size_t(o)] = first;
+
+        std::fill(std::begin(folded), std::end(folded), 0.0);
+        double total = 0;
+        for (size_t k = 0; k < w.size(); ++k) {
+            const int32_t s = clamp_index(s0 + int32_t(k), src);
+            folded[size_t(s - first)] += w[k];
+            total += w[k];
+        }
+
+        // Quantize so the weights sum to exactly 1.0, putting the rounding
+        // error on the largest one
+        int16_t* q = table.weights.data() + size_t(o) * size_t(table.taps);
+        int32_t sum = 0;
+        int32_t largest = 0;
+        for (int32_t t = 0; t < table.taps; ++t) {
+            q[t] = int16_t(
+                std::lround(folded[size_t(t)] / total * (1 << WEIGHT_BITS)));
+            sum += q[t];
+            if (std::abs(q[t]) > std::abs(q[largest])) {
+                largest = t;
+            }
+        }
+        q[largest] = int16_t(q[largest] + (1 << WEIGHT_BITS) - sum);
+    }
+    return table;
+}
+
+// mid[c] = sum_t weights[t] * rows[t][c], rounded to MID_BITS fractional bits
+void vertical_pass(const uint8_t* const* rows,
+                   const int16_t* weights,
+                   int32_t taps,
+                   int32_t* mid,
+                   int32_t n)
+{
+    constexpr int32_t SHIFT = WEIGHT_BITS - MID_BITS;
+    int32_t c = 0;
+#ifdef SIPL_RESIZE_SSE2
+    // Two taps per pmaddwd: interleave the widened pixels of a pair of rows
+    // with the pair's weights
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i round = _mm_set1_epi32(1 << (SHIFT - 1));
+    for (; c + 8 <= n; c += 8) {
+        __m128i lo = round;
+        __m128i hi = round;
+        for (int32_t t = 0; t < taps; t += 2) {
+            const bool pair = t + 1 < taps;
+            const __m128i a = _mm_unpacklo_epi8(
+                _mm_loadl_epi64(reinterpret_cast<const __m128i*>(rows[t] + c)),
+                zero);
+            const __m128i b =
+                pair ? _mm_unpacklo_epi8(
+                           _mm_loadl_epi64(
+                               reinterpret_cast<const __m128i*>(rows[t + 1] +
+                                                                c)),
+                           zero)
+                     : zero;
+            // Pack in unsigned arithmetic: shifting a negative weight left
+            // is undefined
+            const __m128i w = _mm_set1_epi32(int32_t(
+                uint32_t(uint16_t(weights[t])) |
+                (uint32_t(uint16_t(pair ? weights[t + 1] : 0)) << 16)));
+            lo = _mm_add_epi32(lo, _mm_madd_epi16(_mm_unpacklo_epi16(a, b), w));
+            hi = _mm_add_epi32(hi, _mm_madd_epi16(_mm_unpackhi_epi16(a, b), w));
+        }
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mid + c),
+                         _mm_srai_epi32(lo, SHIFT));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mid + c + 4),
+                         _mm_srai_epi32(hi, SHIFT));
+    }
+#endif
+    for (; c < n; ++c) {
+        int32_t sum = 1 << (SHIFT - 1);
+        for (int32_t t = 0; t < taps; ++t) {
+            sum += weights[t] * rows[t][c];
+        }
+        mid[c] = sum >> SHIFT;
+    }
+}
+}
+
+MatrixXb sipl::downsample_box(const MatrixXb& img,
+                              int32_t factor,
+                              int32_t nthreads)
+{
+    assert(factor >= 1 && "factor must be positive");
+    MatrixXb out(img.dims[0] / factor, img.dims[1] / factor);
+    const int32_t cols = out.dims[1];
+    const int32_t used_cols = cols * factor;
+    const uint32_t area = uint32_t(factor * factor);
+    parallel_for(0, out.dims[0],
+                 [&](int32_t begin, int32_t end) {
+                     std::vector<uint32_t> sums(static_cast<size_t>(used_cols));
+                     for (int32_t o = begin; o < end; ++o) {
+                         std::fill(std::begin(sums), std::end(sums), 0);
+                         for (int32_t r = o * factor; r < (o + 1) * factor;
+                              ++r) {
+                             add_row(img.data() + r * img.dims[1],
+                                     sums.data(), used_cols);
+                         }
+                         uint8_t* dst = out.data() + o * cols;
+                         for (int32_t j = 0; j < cols; ++j) {
+                             uint32_t total = 0;
+                             for (int32_t k = 0; k < factor; ++k) {
+                                 total += sums[size_t(j * factor + k)];
+                             }
+                             dst[j] = uint8_t((total + area / 2) / area);
+                         }
+                     }
+                 },
+                 nthreads, MIN_ROWS_PER_THREAD);
+    return out;
+}
+
+MatrixXb sipl::pyr_down(const MatrixXb& img, int32_t nthreads)
+{
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    MatrixXb out((rows + 1) / 2, (cols + 1) / 2);
+    const int32_t out_cols = out.dims[1];
+    const auto row = [&](int32_t r) {
+        return img.data() + clamp_index(r, rows) * cols;
+    };
+    parallel_for(
+        0, out.dims[0],
+        [&](int32_t begin, int32_t end) {
+            std::vector<uint16_t> v(static_cast<size_t>(cols));
+            for (int32_t o = begin; o < end; ++o) {
+                const int32_t r = 2 * o;
+                binomial5(row(r - 2), row(r - 1), row(r), row(r + 1),
+                          row(r + 2), v.data(), cols);
+
+                // Horizontal half, only at the kept columns
+                binomial5_even(v.data(), cols, out.data() + o * out_cols,
+                               out_cols);
+            }
+        },
+        nthreads, MIN_ROWS_PER_THREAD);
+    return out;
+}
+
+MatrixXb sipl::pyr_up(const MatrixXb& img, int32_t nthreads)
+{
+    // Upsampling by inserting zeros and filtering with 4 * [1 4 6 4 1] / 16
+    // leaves two phases per axis: even outputs weigh (1, 6, 1) / 8 around
+    // the source pixel, odd ones (4, 4) / 8 between two source pixels
+    const int32_t rows = img.dims[0];
+    const int32_t cols = img.dims[1];
+    MatrixXb out(2 * rows, 2 * cols);
+    const int32_t out_cols = out.dims[1];
+    const auto row = [&](int32_t r) {
+        return img.data() + clamp_index(r, rows) * cols;
+    };
+    parallel_for(
+        0, out.dims[0],
+        [&](int32_t begin, int32_t end) {
+            std::vector<uint16_t> v(static_cast<size_t>(cols));
+            for (int32_t o = begin; o < end; ++o) {
+                const int32_t i = o / 2;
+                if (o % 2 == 0) {
+                    binomial3(row(i - 1), row(i), row(i + 1), v.data(), cols);
+                } else {
+                    binomial2(row(i), row(i + 1), v.data(), cols);
+                }
+                upsample_row(v.data(), cols, out.data() + o * out_cols);
+            }
+        },
+        nthreads, MIN_ROWS_PER_THREAD);
+    return out;
+}
+
+MatrixXb sipl::resize(const MatrixXb& img,
+                      int32_t rows,
+                      int32_t cols,
+                      ResizeMethod method,
+                      int32_t nthreads)
+{
+    assert(rows > 0 && cols > 0 && "output size must be positive");
+    assert(img.size() > 0 && "can't resize an empty image");
+    const AxisTable vertical = make_table(img.dims[0], rows, method);
+    const AxisTable horizontal = make_table(img.dims[1], cols, method);
+    const int32_t src_cols = img.dims[1];
+    MatrixXb out(rows, cols);
+    parallel_for(
+        0, rows,
+        [&](int32_t begin, int32_t end) {
+            std::vector<const uint8_t*> taps(size_t(vertical.taps));
+            std::vector<int32_t> mid(static_cast<size_t>(src_cols));
+            for (int32_t o = begin; o < end; ++o) {
+                for (int32_t t = 0; t < vertical.taps; ++t) {
+                    taps[size_t(t)] =
+                        img.data() + (vertical.first[size_t(o)] + t) * src_cols;
+                }
+                vertical_pass(taps.data(),
+                              vertical.weights.data() +
+                                  size_t(o) * size_t(vertical.taps),
+                              vertical.taps, mid.data(), src_cols);
+
+                uint8_t* dst = out.data() + o * cols;
+                for (int32_t j = 0; j < cols; ++j) {
+                    const int32_t* m = mid.data() + horizontal.first[size_t(j)];
+                    const int16_t* w = horizontal.weights.data() +
+                                       size_t(j) * size_t(horizontal.taps);
+                    int32_t sum = 1 << (WEIGHT_BITS + MID_BITS - 1);
+                    for (int32_t t = 0; t < horizontal.taps; ++t) {
+                        sum += w[t] * m[t];
+                    }
+                    dst[j] = saturate(sum >> (WEIGHT_BITS + MID_BITS));
+                }
+            }
+        },
+        nthreads, MIN_ROWS_PER_THREAD);
+    return out;
+}
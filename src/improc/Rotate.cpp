@@ -0,0 +1,177 @@
+#include "improc/Rotate.hpp"
+#include <cassert>
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64) || \
+    (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SIPL_ROTATE_SSE2
+#endif
+
+using namespace sipl;
+
+#ifdef SIPL_ROTATE_SSE2
+namespace
+{
+
+// Transpose the 8 x 8 block whose rows start at src[0..7] (8 bytes each):
+// column k of the block is written to the 8 bytes at dst[k]
+inline void transpose_block(const uint8_t* const* src, uint8_t* const* dst)
+{
+    const auto load = [src](int32_t j) {
+        return _mm_loadl_epi64(reinterpret_cast<const __m128i*>(src[j]));
+    };
+    const __m128i t0 = _mm_unpacklo_epi8(load(0), load(1));
+    const __m128i t1 = _mm_unpacklo_epi8(load(2), load(3));
+    const __m128i t2 = _mm_unpacklo_epi8(load(4), load(5));
+    const __m128i t3 = _mm_unpacklo_epi8(load(6), load(7));
+    const __m128i u0 = _mm_unpacklo_epi16(t0, t1);
+    const __m128i u1 = _mm_unpackhi_epi16(t0, t1);
+    const __m128i u2 = _mm_unpacklo_epi16(t2, t3);
+    const __m128i u3 = _mm_unpackhi_epi16(t2, t3);
+    const __m128i columns[4] = {
+        _mm_unpacklo_epi32(u0, u2), _mm_unpackhi_epi32(u0, u2),
+        _mm_unpacklo_epi32(u1, u3), _mm_unpackhi_epi32(u1, u3)};
+    for (int32_t k = 0; k < 4; ++k) {
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst[2 * k]), columns[k]);
+        _mm_storel_epi64(reinterpret_cast<__m128i*>(dst[2 * k + 1]),
+                         _mm_unpackhi_epi64(columns[k], columns[k]));
+    }
+}
+
+// Byte order of a 16-byte vector reversed: dwords, then words within each
+// dword, then bytes within each word
+inline __m128i reverse_bytes(__m128i v)
+{
+    v = _mm_shuffle_epi32(v, _MM_SHUFFLE(0, 1, 2, 3));
+    v = _mm_shufflelo_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    v = _mm_shufflehi_epi16(v, _MM_SHUFFLE(2, 3, 0, 1));
+    return _mm_or_si128(_mm_slli_epi16(v, 8), _mm_srli_epi16(v, 8));
+}
+}
+#endif
+
+void sipl::impl::transpose_copy(const uint8_t* in,
+                                int32_t rows,
+                                int32_t cols,
+                                uint8_t* out,
+                                ptrdiff_t row_step,
+                                ptrdiff_t col_step)
+{
+    assert((col_step == 1 || col_step == -1) && "unsupported col_step");
+    for (int32_t r0 = 0; r0 < rows; r0 += TRANSPOSE_TILE) {
+        const int32_t r1 = std::min(r0 + TRANSPOSE_TILE, rows);
+        for (int32_t c0 = 0; c0 < cols; c0 += TRANSPOSE_TILE) {
+            const int32_t c1 = std::min(c0 + TRANSPOSE_TILE, cols);
+            int32_t r = r0;
+#ifdef SIPL_ROTATE_SSE2
+            // Whole 8 x 8 blocks. Going down the source rows fills a
+            // destination row left to right for col_step 1; for -1 the
+            // rows are loaded bottom up so stores still go left to right
+            const uint8_t* src[8];
+            uint8_t* dst[8];
+            for (; r + 8 <= r1; r += 8) {
+                int32_t c = c0;
+                for (; c + 8 <= c1; c += 8) {
+                    for (int32_t j = 0; j < 8; ++j) {
+                        const int32_t row = col_step == 1 ? r + j : r + 7 - j;
+                        src[j] = in + ptrdiff_t(row) * cols + c;
+                        dst[j] = out + (c + j) * row_step +
+                                 (col_step == 1 ? r : -(r + 7));
+                    }
+                    transpose_block(src, dst);
+                }
+
+                // Columns left over at the right of the tile
+                for (; c < c1; ++c) {
+                    for (int32_t j = r; j < r + 8; ++j) {
+                        out[c * row_step + j * col_step] =
+                            in[ptrdiff_t(j) * cols + c];
+                    }
+                }
+            }
+#endif
+            // Rows left over at the bottom of the tile
+            for (; r < r1; ++r) {
+                for (int32_t c = c0; c < c1; ++c) {
+                    out[c * row_step + r * col_step] =
+                        in[ptrdiff_t(r) * cols + c];
+                }
+            }
+        }
+    }
+}
+
+void sipl::impl::reverse_row(const uint8_t* in, uint8_t* out, int32_t n)
+{
+    int32_t i = 0;
+#ifdef SIPL_ROTATE_SSE2
+    for (; i + 16 <= n; i += 16) {
+        const __m128i v =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(in + n - 16 - i));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i),
+                         reverse_bytes(v));
+    }
+#endif
+    for (; i < n; ++i) {
+        out[i] = in[n - 1 - i];
+    }
+}
+
+void sipl::impl::shift_row(const uint8_t* in,
+                           int32_t n,
+                           double shift,
+                           uint8_t* out,
+                           int32_t m,
+                           uint8_t fill_value)
+{
+    int32_t begin, end;
+    shift_bounds(n, shift, m, begin, end);
+    std::fill(out, out + begin, fill_value);
+    std::fill(out + end, out + m, fill_value);
+    if (begin == end) {
+        return;
+    }
+
+    const double base = std::floor(shift);
+    const auto offset = int32_t(base);
+    const auto w = int32_t((shift - base) * 256 + 0.5);
+    if (w == 0 || w == 256) {
+        // Whole-pixel shift (or close enough at 1/256 precision)
+        const int32_t whole = offset + w / 256;
+        std::copy(in + begin + whole, in + end + whole, out + begin);
+        return;
+    }
+
+    const uint8_t* src = in + offset;
+    int32_t j = begin;
+#ifdef SIPL_ROTATE_SSE2
+    // Pixel pairs widened to 16 bits: at most 255 * 256 + 128, so the blend
+    // fits unsigned 16-bit lanes
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i w0 = _mm_set1_epi16(int16_t(256 - w));
+    const __m128i w1 = _mm_set1_epi16(int16_t(w));
+    const __m128i round = _mm_set1_epi16(128);
+    const auto blend = [&](__m128i a, __m128i b) {
+        const __m128i sum = _mm_add_epi16(
+            _mm_add_epi16(_mm_mullo_epi16(a, w0), _mm_mullo_epi16(b, w1)),
+            round);
+        return _mm_srli_epi16(sum, 8);
+    };
+    for (; j + 16 <= end; j += 16) {
+        const __m128i a =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j));
+        const __m128i b =
+            _mm_loadu_si128(reinterpret_cast<const __m128i*>(src + j + 1));
+        const __m128i lo = blend(_mm_unpacklo_epi8(a, zero),
+                                 _mm_unpacklo_epi8(b, zero));
+        const __m128i hi = blend(_mm_unpackhi_epi8(a, zero),
+                                 _mm_unpackhi_epi8(b, zero));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + j),
+                         _mm_packus_epi16(lo, hi));
+    }
+#endif
+    for (; j < end; ++j) {
+        out[j] = uint8_t((src[j] * (256 - w) + src[j + 1] * w + 128) >> 8);
+    }
+}
@@ -0,0 +1,231 @@
+#include "improc/WarpMap.hpp"
+#include "improc/Interpolate.hpp"
+#include "Parallel.hpp"
+#include <cassert>
+#include <cmath>
+
+using namespace sipl;
+
+namespace
+{
+
+// Rows per thread below which splitting the work costs more than it saves
+constexpr int32_t MIN_ROWS_PER_THREAD = 16;
+
+// Applies block(i) to each run of impl::SPAN_BLOCK output pixels from i on
+// that all read the source, pixel(dst, offset, i) to the other pixels that do,
+// and fills the rest
+template <typename Dtype, typename PixelFunction, typename BlockFunction>
+void remap_rows(const WarpMap& map,
+                MatrixX<Dtype>& out,
+                const Dtype& fill_value,
+                int32_t nthreads,
+                PixelFunction pixel,
+                BlockFunction block)
+{
+    if (out.dims != map.dims()) {
+        out = MatrixX<Dtype>(map.dims());
+    }
+    const int32_t cols = map.dims()[1];
+    parallel_for(0, map.dims()[0],
+                 [&](int32_t begin, int32_t end) {
+                     const auto single = [&](int32_t i) {
+                         if (map.offset(i) < 0) {
+                             out[i] = fill_value;
+                         } else {
+                             pixel(out[i], map.offset(i), i);
+                         }
+                     };
+                     const int32_t last = end * cols;
+                     int32_t i = begin * cols;
+                     for (; i + impl::SPAN_BLOCK <= last;
+                          i += impl::SPAN_BLOCK) {
+                         bool inside = true;
+                         for (int32_t k = 0; k < impl::SPAN_BLOCK; ++k) {
+                             inside &= map.offset(i + k) >= 0;
+                         }
+                         if (inside) {
+                             block(i);
+                             continue;
+                         }
+                         for (int32_t k = 0; k < impl::SPAN_BLOCK; ++k) {
+                             single(i + k);
+                         }
+                     }
+                     for (; i < last; ++i) {
+                         single(i);
+                     }
+                 },
+                 nthreads, MIN_ROWS_PER_THREAD);
+}
+}
+
+sipl::WarpMap::WarpMap(const std::array<int32_t, 2>& src_dims,
+                       const Matrix33d& transform,
+                       InterpolateType interpolation,
+                       int32_t nthreads)
+    : src_dims_(src_dims)
+    , dims_()
+    , interpolation_(interpolation)
+{
+    assert((interpolation == InterpolateType::BILINEAR ||
+            interpolation == InterpolateType::NEAREST_NEIGHBOR) &&
+           "WarpMap supports bilinear and nearest neighbor interpolation");
+    const auto geometry = impl::warp_geometry(src_dims, transform);
+    dims_ = geometry.dims;
+    const auto npixels = size_t(dims_[0]) * size_t(dims_[1]);
+    offsets_.resize(npixels);
+    weights_x_.resize(npixels);
+    weights_y_.resize(npixels);
+
+    const impl::ScanlineMapper mapper(inv(transform), geometry.u_offset,
+                                      geometry.v_offset);
+    const int32_t src_rows = src_dims[0];
+    const int32_t src_cols = src_dims[1];
+    const bool bilinear = interpolation == InterpolateType::BILINEAR;
+    parallel_for(
+        0, dims_[0],
+        [&](int32_t begin, int32_t end) {
+            double xs[impl::WARP_BLOCK];
+            double ys[impl::WARP_BLOCK];
+            for (int32_t i = begin; i < end; ++i) {
+                for (int32_t j = 0; j < dims_[1]; j += impl::WARP_BLOCK) {
+                    mapper.map(i, j, xs, ys);
+                    const int32_t n = std::min(impl::WARP_BLOCK, dims_[1] - j);
+                    for (int32_t k = 0; k < n; ++k) {
+                        const auto p = size_t(i) * size_t(dims_[1]) +
+                                       size_t(j + k);
+                        const double x = xs[k];
+                        const double y = ys[k];
+                        offsets_[p] = -1;
+                        weights_x_[p] = 0;
+                        weights_y_[p] = 0;
+
+                        // Same bounds as the interpolators: all four
+                        // bilinear neighbors, or the rounded pixel, must be
+                        // inside the source. Written so NaNs fail
+                        if (bilinear) {
+                            if (x >= 0 && x < src_cols - 1 && y >= 0 &&
+                                y < src_rows - 1) {
+                                const auto x1 = int32_t(x);
+                                const auto y1 = int32_t(y);
+                                offsets_[p] = y1 * src_cols + x1;
+                                weights_x_[p] =
+                                    uint16_t(std::lround((x - x1) * 256));
+                                weights_y_[p] =
+                                    uint16_t(std::lround((y - y1) * 256));
+                            }
+                        } else if (x > -0.5 && x < src_cols - 0.5 &&
+                                   y > -0.5 && y < src_rows - 0.5) {
+                            offsets_[p] = int32_t(std::round(y)) * src_cols +
+                                          int32_t(std::round(x));
+                        }
+                    }
+                }
+            }
+        },
+        nthreads, MIN_ROWS_PER_THREAD);
+}
+
+void sipl::remap(const MatrixXb& frame,
+                 const WarpMap& map,
+                 MatrixXb& out,
+                 uint8_t fill_value,
+                 int32_t nthreads)
+{
+    assert(frame.dims == map.src_dims() && "size mismatch");
+    const uint8_t* src = frame.data();
+    const int32_t stride = frame.dims[1];
+    if (map.interpolation() == InterpolateType::NEAREST_NEIGHBOR) {
+        const auto pixel = [src](uint8_t& dst, int32_t offset, int32_t) {
+            dst = src[offset];
+        };
+        remap_rows(map, out, fill_value, nthreads, pixel,
+                   [&](int32_t i) {
+                       for (int32_t k = 0; k < impl::SPAN_BLOCK; ++k) {
+                           pixel(out[i + k], map.offset(i + k), i + k);
+                       }
+                   });
+        return;
+    }
+
+    // Gather the corners and weights of a block for the bilinear_span kernel
+    remap_rows(map, out, fill_value, nthreads,
+               [&](uint8_t& dst, int32_t offset, int32_t i) {
+                   const uint8_t* p = src + offset;
+                   dst = impl::blend_q8(p[0], p[1], p[stride], p[stride + 1],
+                                        map.weight_x(i), map.weight_y(i));
+               },
+               [&](int32_t i) {
+                   impl::Corners c;
+                   alignas(16) int16_t wx[impl::SPAN_BLOCK];
+                   alignas(16) int16_t wy[impl::SPAN_BLOCK];
+                   for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+                       const uint8_t* p = src + map.offset(i + q);
+                       c.p00[q] = p[0];
+                       c.p01[q] = p[1];
+                       c.p10[q] = p[stride];
+                       c.p11[q] = p[stride + 1];
+                       wx[q] = int16_t(map.weight_x(i + q));
+                       wy[q] = int16_t(map.weight_y(i + q));
+                   }
+                   impl::blend_block(c, wx, wy, out.data() + i);
+               });
+}
+
+void sipl::remap(const MatrixX<RgbPixel>& frame,
+                 const WarpMap& map,
+                 MatrixX<RgbPixel>& out,
+                 const RgbPixel& fill_value,
+                 int32_t nthreads)
+{
+    assert(frame.dims == map.src_dims() && "size mismatch");
+    const RgbPixel* src = frame.data();
+    const int32_t stride = frame.dims[1];
+    if (map.interpolation() == InterpolateType::NEAREST_NEIGHBOR) {
+        const auto pixel = [src](RgbPixel& dst, int32_t offset, int32_t) {
+            dst = src[offset];
+        };
+        remap_rows(map, out, fill_value, nthreads, pixel, [&](int32_t i) {
+            for (int32_t k = 0; k < impl::SPAN_BLOCK; ++k) {
+                pixel(out[i + k], map.offset(i + k), i + k);
+            }
+        });
+        return;
+    }
+
+    // As for gray, with one pass of the kernel per channel
+    remap_rows(map, out, fill_value, nthreads,
+               [&](RgbPixel& dst, int32_t offset, int32_t i) {
+                   const RgbPixel* p = src + offset;
+                   for (int32_t c = 0; c < 3; ++c) {
+                       dst[c] = impl::blend_q8(p[0][c], p[1][c], p[stride][c],
+                                               p[stride + 1][c],
+                                               map.weight_x(i),
+                                               map.weight_y(i));
+                   }
+               },
+               [&](int32_t i) {
+                   impl::Corners c;
+                   alignas(16) int16_t wx[impl::SPAN_BLOCK];
+                   alignas(16) int16_t wy[impl::SPAN_BLOCK];
+                   uint8_t channel[impl::SPAN_BLOCK];
+                   for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+                       wx[q] = int16_t(map.weight_x(i + q));
+                       wy[q] = int16_t(map.weight_y(i + q));
+                   }
+                   for (int32_t ch = 0; ch < 3; ++ch) {
+                       for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+                           const RgbPixel* p = src + map.offset(i + q);
+                           c.p00[q] = p[0][ch];
+                           c.p01[q] = p[1][ch];
+                           c.p10[q] = p[stride][ch];
+                           c.p11[q] = p[stride + 1][ch];
+                       }
+                       impl::blend_block(c, wx, wy, channel);
+                       for (int32_t q = 0; q < impl::SPAN_BLOCK; ++q) {
+                           out[i + q][ch] = channel[q];
+                       }
+                   }
+               });
+}
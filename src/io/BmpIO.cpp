@@ -1,13 +1,58 @@
 #include <string>
 #include <fstream>
 #include <memory>
+#include <cstdlib>
 #include <limits>
+#include <algorithm>
 #include "matrix/Matrix"
 #include "io/BmpIO.hpp"
 #include "Common.hpp"
 
 using namespace sipl;
 
+ImageInfo BmpIO::info(const std::string& filename)
+{
+    std::ifstream stream{filename, std::ios::binary};
+    if (!stream) {
+        throw IOException("Could not open file '" + filename + "' for reading");
+    }
+
+    BITMAPFILEHEADER file_header;
+    BITMAPINFOHEADER info_header;
+    stream.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
+    stream.read(reinterpret_cast<char*>(&info_header), sizeof(info_header));
+    if (!stream || (file_header.bfType & 0xff) != 'B' ||
+        (file_header.bfType >> 8) != 'M') {
+        throw IOException("Not a BMP file: " + filename);
+    }
+
+    // Negative height means the rows are stored top-down
+    ImageInfo info;
+    info.type = FileType::BMP;
+    info.width = info_header.biWidth;
+    info.height = std::abs(info_header.biHeight);
+    switch (info_header.biBitCount) {
+    case 32:
+        info.channels = 4;
+        info.bit_depth = 8;
+        break;
+    case 24:
+        info.channels = 3;
+        info.bit_depth = 8;
+        break;
+    case 16:
+        info.channels = 3;
+        info.bit_depth = 5;
+        break;
+    default:
+        // 1, 4 and 8 bit images are palette (or, for us, gray) indices
+        info.channels = 1;
+        info.bit_depth = info_header.biBitCount;
+    }
+
+    return info;
+}
+
 MatrixXb BmpIO::read(const char* filename)
 {
     return read(std::string(filename));
@@ -45,14 +90,12 @@ MatrixXb BmpIO::read(const std::string& filename)
     const int32_t padded_row_size =
         int32_t(std::floor((sizeof(uint8_t) * 8 * img.dims[1] + 31) / 32) * 4);
 
-    // "normal" position, not in the "image" position
+    // "normal" position, not in the "image" position. Pixels are already
+    // 8-bit gray, so rows are copied as-is
     for (int32_t i = img.dims[0] - 1; i >= 0; --i) {
         const auto off = i * padded_row_size;
-        for (int32_t j = 0; j < img.dims[1]; ++j) {
-            const auto grayval = uint8_t(data_start[j + off]);
-            img(img.dims[0] - 1 - i, j) = clamp<uint8_t>(
-                0.299 * grayval + 0.587 * grayval + 0.114 * grayval);
-        }
+        std::copy(data_start + off, data_start + off + img.dims[1],
+                  img.data() + (img.dims[0] - 1 - i) * img.dims[1]);
     }
 
     return img;
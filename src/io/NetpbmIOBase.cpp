@@ -3,6 +3,42 @@
 
 using namespace sipl;
 
+ImageInfo NetpbmIOBase::info(const std::string& filename)
+{
+    std::ifstream stream{filename, std::ios::binary};
+    if (!stream) {
+        throw NetpbmIOException("Could not open file to read header");
+    }
+
+    // process_header() skips the magic number, so look at it first
+    char magic[2] = {'\0', '\0'};
+    stream.read(magic, 2);
+    stream.seekg(0);
+
+    ImageInfo info;
+    if (magic[0] == 'P' && (magic[1] == '2' || magic[1] == '5')) {
+        info.type = sipl::FileType::PGM;
+        info.channels = 1;
+    } else if (magic[0] == 'P' && (magic[1] == '3' || magic[1] == '6')) {
+        info.type = sipl::FileType::PPM;
+        info.channels = 3;
+    } else {
+        throw NetpbmIOException("Unknown file type, check magic number");
+    }
+
+    int32_t maxval;
+    std::tie(info.height, info.width, maxval) = process_header(stream);
+
+    // Number of bits needed to hold maxval
+    info.bit_depth = 0;
+    while (maxval > 0) {
+        ++info.bit_depth;
+        maxval >>= 1;
+    }
+
+    return info;
+}
+
 // Process the header of both ASCII and Binary files
 std::tuple<int32_t, int32_t, int32_t> NetpbmIOBase::process_header(
     std::ifstream& stream)
@@ -1,5 +1,6 @@
 #include <iostream>
 #include <tuple>
+#include <limits>
 #include <cassert>
 #include "io/PgmIO.hpp"
 
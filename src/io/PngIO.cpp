@@ -1,10 +1,149 @@
 #include "io/PngIO.hpp"
 #include "matrix/Matrix"
 #include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <thread>
 #include <vector>
 
 using namespace sipl;
 
+namespace
+{
+
+// Don't split the image data into bands smaller than this; below it the
+// thread startup costs more than the deflate saves
+constexpr size_t MIN_BAND_BYTES = size_t(1) << 17;
+
+// Handed to parallel_zlib through LodePNGCompressSettings::custom_context
+struct ParallelZlibContext {
+    int32_t nthreads;
+    int32_t nrows;
+};
+
+// One horizontal band's share of the zlib stream
+struct DeflateBand {
+    unsigned char* data = nullptr;
+    size_t size = 0;
+    size_t insize = 0;
+    unsigned adler = 1;
+    unsigned error = 0;
+};
+
+// Replacement for lodepng's zlib_compress that deflates horizontal bands of
+// the filtered scanlines on separate threads. Every band but the last ends in
+// a sync flush so the pieces can be concatenated, and the Adler32s of the
+// bands are combined into the one for the whole stream
+unsigned parallel_zlib(unsigned char** out,
+                       size_t* outsize,
+                       const unsigned char* in,
+                       size_t insize,
+                       const LodePNGCompressSettings* settings)
+{
+    const auto ctx =
+        static_cast<const ParallelZlibContext*>(settings->custom_context);
+
+    const size_t max_bands =
+        std::min(size_t(ctx->nthreads), insize / MIN_BAND_BYTES);
+    if (max_bands < 2) {
+        return lodepng_zlib_compress(out, outsize, in, insize, settings);
+    }
+
+    // Each scanline is its filter type byte followed by the filtered row, so
+    // split on multiples of that when we can
+    const size_t row_bytes =
+        (insize % size_t(ctx->nrows) == 0 ? insize / size_t(ctx->nrows) : 1);
+    const size_t nrows = insize / row_bytes;
+    const size_t band_bytes = ((nrows + max_bands - 1) / max_bands) * row_bytes;
+    const size_t nbands = (insize + band_bytes - 1) / band_bytes;
+
+    std::vector<DeflateBand> bands(nbands);
+    std::vector<std::thread> workers;
+    workers.reserve(nbands);
+    for (size_t b = 0; b < nbands; ++b) {
+        const size_t start = b * band_bytes;
+        bands[b].insize = std::min(band_bytes, insize - start);
+        workers.emplace_back([&bands, in, settings, start, b, nbands]() {
+            auto& band = bands[b];
+            band.error =
+                lodepng_deflate_piece(&band.data, &band.size, in + start,
+                                      band.insize, settings, b == nbands - 1);
+            band.adler = lodepng_adler32(in + start, band.insize);
+        });
+    }
+    for (auto& w : workers) {
+        w.join();
+    }
+
+    // Stitch together: 2-byte zlib header, deflate pieces, big-endian Adler32.
+    // Header is the same one lodepng writes (32K window, no dictionary)
+    unsigned error = 0;
+    size_t total = 2 + 4;
+    unsigned adler = 1;
+    for (const auto& band : bands) {
+        if (band.error && !error) {
+            error = band.error;
+        }
+        total += band.size;
+        adler = lodepng_adler32_combine(adler, band.adler, band.insize);
+    }
+
+    auto buf = static_cast<unsigned char*>(std::realloc(*out, *outsize + total));
+    if (!error && !buf) {
+        error = 83;  // lodepng's "memory allocation failed"
+    }
+    if (!error) {
+        unsigned char* p = buf + *outsize;
+        *p++ = 0x78;
+        *p++ = 0x01;
+        for (const auto& band : bands) {
+            std::memcpy(p, band.data, band.size);
+            p += band.size;
+        }
+        *p++ = uint8_t(adler >> 24);
+        *p++ = uint8_t(adler >> 16);
+        *p++ = uint8_t(adler >> 8);
+        *p++ = uint8_t(adler);
+        *out = buf;
+        *outsize += total;
+    } else if (buf) {
+        *out = buf;
+    }
+
+    for (auto& band : bands) {
+        std::free(band.data);
+    }
+    return error;
+}
+}
+
+ImageInfo PngIO::info(const std::string& filename)
+{
+    std::ifstream stream{filename, std::ios::binary};
+    if (!stream) {
+        throw IOException("could not open png file");
+    }
+
+    // 8-byte signature followed by the IHDR chunk is 33 bytes
+    unsigned char header[33];
+    stream.read(reinterpret_cast<char*>(header), sizeof(header));
+    unsigned width, height;
+    lodepng::State state;
+    if (!stream ||
+        lodepng_inspect(&width, &height, &state, header, sizeof(header))) {
+        throw IOException("could not read png header");
+    }
+
+    ImageInfo info;
+    info.type = FileType::PNG;
+    info.width = int32_t(width);
+    info.height = int32_t(height);
+    info.channels = int32_t(lodepng_get_channels(&state.info_png.color));
+    info.bit_depth = int32_t(state.info_png.color.bitdepth);
+    return info;
+}
+
 MatrixX<RgbPixel> PngIO::read(const char* filename)
 {
     return read(std::string(filename));
@@ -30,12 +169,16 @@ MatrixX<RgbPixel> PngIO::read(const std::string& filename)
     return mat;
 }
 
-void PngIO::write(const MatrixX<RgbPixel>& mat, const char* filename)
+void PngIO::write(const MatrixX<RgbPixel>& mat,
+                  const char* filename,
+                  int32_t nthreads)
 {
-    write(mat, std::string(filename));
+    write(mat, std::string(filename), nthreads);
 }
 
-void PngIO::write(const MatrixX<RgbPixel>& mat, const std::string& filename)
+void PngIO::write(const MatrixX<RgbPixel>& mat,
+                  const std::string& filename,
+                  int32_t nthreads)
 {
     std::vector<uint8_t> pixels;
     for (int32_t i = 0; i < mat.size(); ++i) {
@@ -44,8 +187,28 @@ void PngIO::write(const MatrixX<RgbPixel>& mat, const std::string& filename)
         pixels.push_back(mat[i][2]);
     }
 
-    auto error = lodepng::encode(filename, pixels, mat.dims[1], mat.dims[0],
-                                 LodePNGColorType::LCT_RGB, 8);
+    if (nthreads <= 0) {
+        nthreads = std::max(1, int32_t(std::thread::hardware_concurrency()));
+    }
+
+    // Same settings lodepng::encode() uses, plus the threaded zlib stage
+    lodepng::State state;
+    state.info_raw.colortype = LodePNGColorType::LCT_RGB;
+    state.info_raw.bitdepth = 8;
+    state.info_png.color.colortype = LodePNGColorType::LCT_RGB;
+    state.info_png.color.bitdepth = 8;
+    ParallelZlibContext ctx{nthreads, mat.dims[0]};
+    if (nthreads > 1) {
+        state.encoder.zlibsettings.custom_zlib = parallel_zlib;
+        state.encoder.zlibsettings.custom_context = &ctx;
+    }
+
+    std::vector<uint8_t> png;
+    auto error =
+        lodepng::encode(png, pixels, mat.dims[1], mat.dims[0], state);
+    if (!error) {
+        error = lodepng::save_file(png, filename);
+    }
     if (error) {
         throw IOException("could not save png");
     }
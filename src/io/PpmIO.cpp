@@ -1,5 +1,6 @@
 #include <iostream>
 #include <tuple>
+#include <limits>
 #include "io/PpmIO.hpp"
 
 using namespace sipl;
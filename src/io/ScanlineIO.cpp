@@ -0,0 +1,496 @@
+#include "io/ScanlineIO.hpp"
+#include "io/BmpIO.hpp"
+#include "lodepng.h"
+#include <array>
+#include <cstdlib>
+#include <cstring>
+#include <limits>
+#include <sstream>
+#include <tuple>
+
+using namespace sipl;
+
+namespace
+{
+
+// Copy between packed 8-bit samples (as stored in files) and Matrix elements
+inline void unpack_row(const uint8_t* bytes, uint8_t* row, int32_t cols)
+{
+    std::memcpy(row, bytes, size_t(cols));
+}
+
+inline void unpack_row(const uint8_t* bytes, RgbPixel* row, int32_t cols)
+{
+    for (int32_t j = 0; j < cols; ++j) {
+        row[j][0] = bytes[3 * j + 0];
+        row[j][1] = bytes[3 * j + 1];
+        row[j][2] = bytes[3 * j + 2];
+    }
+}
+
+inline void pack_row(const uint8_t* row, uint8_t* bytes, int32_t cols)
+{
+    std::memcpy(bytes, row, size_t(cols));
+}
+
+inline void pack_row(const RgbPixel* row, uint8_t* bytes, int32_t cols)
+{
+    for (int32_t j = 0; j < cols; ++j) {
+        bytes[3 * j + 0] = row[j][0];
+        bytes[3 * j + 1] = row[j][1];
+        bytes[3 * j + 2] = row[j][2];
+    }
+}
+
+template <typename Dtype>
+struct Channels;
+
+template <>
+struct Channels<uint8_t> {
+    static constexpr int32_t value = 1;
+};
+
+template <>
+struct Channels<RgbPixel> {
+    static constexpr int32_t value = 3;
+};
+
+// Rows padded to a multiple of 4 bytes, see BmpIO::write
+inline int32_t bmp_padded_row_size(int32_t cols) { return (cols + 3) / 4 * 4; }
+
+// Rows of filtered scanlines to gather before deflating them as one band
+constexpr size_t PNG_BAND_BYTES = size_t(1) << 18;
+
+// PNG can't store empty images: IHDR needs both sizes positive and the data
+// at least one IDAT chunk. Checked before the file is created
+inline int32_t png_size(int32_t size)
+{
+    if (size <= 0) {
+        throw IOException("png images can't be empty");
+    }
+    return size;
+}
+
+inline void append_be32(std::vector<uint8_t>& v, uint32_t x)
+{
+    v.push_back(uint8_t(x >> 24));
+    v.push_back(uint8_t(x >> 16));
+    v.push_back(uint8_t(x >> 8));
+    v.push_back(uint8_t(x));
+}
+
+void write_png_chunk(std::ofstream& stream,
+                     const char* type,
+                     const uint8_t* data,
+                     size_t size)
+{
+    std::vector<uint8_t> chunk;
+    chunk.reserve(size + 12);
+    append_be32(chunk, uint32_t(size));
+    chunk.insert(std::end(chunk), type, type + 4);
+    chunk.insert(std::end(chunk), data, data + size);
+    append_be32(chunk, lodepng_crc32(chunk.data() + 4, size + 4));
+    stream.write(reinterpret_cast<const char*>(chunk.data()),
+                 std::streamsize(chunk.size()));
+}
+
+inline uint8_t paeth_predictor(int32_t a, int32_t b, int32_t c)
+{
+    const int32_t pa = std::abs(b - c);
+    const int32_t pb = std::abs(a - c);
+    const int32_t pc = std::abs(a + b - c - c);
+    if (pc < pa && pc < pb) {
+        return uint8_t(c);
+    } else if (pb < pa) {
+        return uint8_t(b);
+    } else {
+        return uint8_t(a);
+    }
+}
+
+// Filter one scanline with each of the five PNG filter types and keep the one
+// whose output has the smallest sum of (signed) magnitudes, the same
+// heuristic lodepng's default LFS_MINSUM uses. Appends the filter type byte
+// and the filtered row to out
+void filter_scanline(const std::vector<uint8_t>& row,
+                     const std::vector<uint8_t>& prev,
+                     size_t bpp,
+                     std::vector<uint8_t>& scratch,
+                     std::vector<uint8_t>& out)
+{
+    const size_t len = row.size();
+    scratch.resize(5 * len);
+    std::array<size_t, 5> sums{{0, 0, 0, 0, 0}};
+    for (size_t i = 0; i < len; ++i) {
+        const int32_t a = (i >= bpp ? row[i - bpp] : 0);
+        const int32_t b = prev[i];
+        const int32_t c = (i >= bpp ? prev[i - bpp] : 0);
+        const std::array<int32_t, 5> predictions{
+            {0, a, b, (a + b) / 2, paeth_predictor(a, b, c)}};
+        for (size_t t = 0; t < 5; ++t) {
+            const auto f = uint8_t(row[i] - predictions[t]);
+            scratch[t * len + i] = f;
+            sums[t] += (f < 128 ? f : 256 - f);
+        }
+    }
+
+    const auto best = std::min_element(std::begin(sums), std::end(sums)) -
+                      std::begin(sums);
+    out.push_back(uint8_t(best));
+    out.insert(std::end(out), std::begin(scratch) + best * len,
+               std::begin(scratch) + (best + 1) * len);
+}
+}
+
+// Netpbm
+
+template <typename Dtype>
+NetpbmScanlineReader<Dtype>::NetpbmScanlineReader(const std::string& filename)
+    : stream_(filename, std::ios::binary)
+{
+    if (!stream_) {
+        throw NetpbmIOException("Could not open file for reading");
+    }
+
+    const auto info = NetpbmIOBase::info(filename);
+    if (info.channels != Channels<Dtype>::value) {
+        throw NetpbmIOException("Wrong number of channels for this reader");
+    }
+
+    char magic[2];
+    stream_.read(magic, 2);
+    stream_.seekg(0);
+    binary_ = (magic[1] == '5' || magic[1] == '6');
+
+    int32_t maxval;
+    std::tie(this->rows_, this->cols_, maxval) = process_header(stream_);
+    if (maxval > std::numeric_limits<uint8_t>::max()) {
+        throw NetpbmIOException("Only 8-bit images are supported");
+    }
+
+    // Skip the single whitespace character after the header
+    if (binary_) {
+        stream_.get();
+    }
+    row_buf_.resize(size_t(this->cols_ * Channels<Dtype>::value));
+}
+
+template <typename Dtype>
+void NetpbmScanlineReader<Dtype>::read_rows(Dtype* out, int32_t nrows)
+{
+    std::string pixval;
+    for (int32_t i = 0; i < nrows; ++i) {
+        if (binary_) {
+            stream_.read(reinterpret_cast<char*>(row_buf_.data()),
+                         std::streamsize(row_buf_.size()));
+        } else {
+            for (auto& e : row_buf_) {
+                stream_ >> pixval;
+                e = uint8_t(std::stoul(pixval));
+            }
+        }
+        if (!stream_) {
+            throw NetpbmIOException("Unexpected end of file");
+        }
+        unpack_row(row_buf_.data(), out + i * this->cols_, this->cols_);
+    }
+}
+
+template <typename Dtype>
+NetpbmScanlineWriter<Dtype>::NetpbmScanlineWriter(const std::string& filename,
+                                                  int32_t rows,
+                                                  int32_t cols)
+    : ScanlineWriter<Dtype>(rows, cols)
+    , stream_(filename, std::ios::binary | std::ios::trunc)
+    , row_buf_(size_t(cols * Channels<Dtype>::value))
+{
+    if (!stream_) {
+        throw NetpbmIOException("Could not open file for writing binary");
+    }
+
+    std::stringstream ss;
+    ss << (Channels<Dtype>::value == 1 ? "P5" : "P6") << std::endl
+       << cols << " " << rows << std::endl
+       << std::to_string(std::numeric_limits<uint8_t>::max()) << std::endl;
+    stream_.write(ss.str().c_str(), int64_t(ss.str().size()));
+}
+
+template <typename Dtype>
+NetpbmScanlineWriter<Dtype>::~NetpbmScanlineWriter()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+template <typename Dtype>
+void NetpbmScanlineWriter<Dtype>::write_rows(const Dtype* rows, int32_t nrows)
+{
+    for (int32_t i = 0; i < nrows; ++i) {
+        pack_row(rows + i * this->cols_, row_buf_.data(), this->cols_);
+        stream_.write(reinterpret_cast<const char*>(row_buf_.data()),
+                      std::streamsize(row_buf_.size()));
+    }
+}
+
+template <typename Dtype>
+void NetpbmScanlineWriter<Dtype>::close()
+{
+    if (!stream_.is_open()) {
+        return;
+    }
+    stream_.close();
+    if (this->rows_written_ != this->rows_) {
+        throw NetpbmIOException("Image closed before all rows were written");
+    }
+}
+
+namespace sipl
+{
+template class NetpbmScanlineReader<uint8_t>;
+template class NetpbmScanlineReader<RgbPixel>;
+template class NetpbmScanlineWriter<uint8_t>;
+template class NetpbmScanlineWriter<RgbPixel>;
+}
+
+// BMP
+
+BmpScanlineReader::BmpScanlineReader(const std::string& filename)
+    : stream_(filename, std::ios::binary)
+{
+    if (!stream_) {
+        throw IOException("Could not open file '" + filename + "' for reading");
+    }
+
+    BmpIO::BITMAPFILEHEADER file_header;
+    BmpIO::BITMAPINFOHEADER info_header;
+    stream_.read(reinterpret_cast<char*>(&file_header), sizeof(file_header));
+    stream_.read(reinterpret_cast<char*>(&info_header), sizeof(info_header));
+    if (!stream_ || info_header.biBitCount != 8) {
+        throw IOException("Only 8-bit BMP files are supported: " + filename);
+    }
+
+    // Negative height means rows are stored top-down
+    rows_ = std::abs(info_header.biHeight);
+    cols_ = info_header.biWidth;
+    bottom_up_ = info_header.biHeight > 0;
+    data_offset_ = std::streamoff(file_header.bfOffBits);
+    padded_row_size_ = bmp_padded_row_size(cols_);
+}
+
+void BmpScanlineReader::read_rows(uint8_t* out, int32_t nrows)
+{
+    for (int32_t i = 0; i < nrows; ++i) {
+        const int32_t row = rows_read_ + i;
+        const int32_t stored_row = (bottom_up_ ? rows_ - 1 - row : row);
+        stream_.seekg(data_offset_ + std::streamoff(stored_row) *
+                                         std::streamoff(padded_row_size_));
+        stream_.read(reinterpret_cast<char*>(out + i * cols_), cols_);
+        if (!stream_) {
+            throw IOException("Unexpected end of BMP file");
+        }
+    }
+}
+
+BmpScanlineWriter::BmpScanlineWriter(const std::string& filename,
+                                     int32_t rows,
+                                     int32_t cols)
+    : ScanlineWriter<uint8_t>(rows, cols)
+    , stream_(filename, std::ios::binary | std::ios::trunc)
+    , padded_row_size_(bmp_padded_row_size(cols))
+{
+    if (!stream_) {
+        throw IOException("Could not open file '" + filename +
+                          "' for writing binary");
+    }
+
+    // Same headers and gray color table as BmpIO::write
+    const int32_t color_table_size = (1 << 8) * 4;
+    uint8_t color_table[color_table_size];
+    for (int32_t i = 0; i < (1 << 8); ++i) {
+        color_table[i * 4 + 0] = uint8_t(i);
+        color_table[i * 4 + 1] = uint8_t(i);
+        color_table[i * 4 + 2] = uint8_t(i);
+        color_table[i * 4 + 3] = 0;
+    }
+
+    BmpIO::BITMAPFILEHEADER file_header;
+    file_header.bfType = uint16_t('B' | ('M' << 8));
+    file_header.bfOffBits = sizeof(BmpIO::BITMAPFILEHEADER) +
+                            sizeof(BmpIO::BITMAPINFOHEADER) + color_table_size;
+    file_header.bfSize = padded_row_size_ * rows + file_header.bfOffBits;
+    file_header.bfReserved1 = 0;
+    file_header.bfReserved2 = 0;
+
+    BmpIO::BITMAPINFOHEADER info_header;
+    info_header.biSize = 40;
+    info_header.biWidth = cols;
+    info_header.biHeight = rows;
+    info_header.biPlanes = 1;
+    info_header.biBitCount = 8;
+    info_header.biCompression = 0;
+    info_header.biSizeImage = rows * cols;
+    info_header.biXPelsPerMeter = 0;
+    info_header.biYPelsPerMeter = 0;
+    info_header.biClrUsed = std::numeric_limits<uint8_t>::max() + 1;
+    info_header.biClrImportant = 0;
+
+    stream_.write(reinterpret_cast<const char*>(&file_header),
+                  sizeof(file_header));
+    stream_.write(reinterpret_cast<const char*>(&info_header),
+                  sizeof(info_header));
+    stream_.write(reinterpret_cast<const char*>(color_table),
+                  color_table_size);
+    data_offset_ = std::streamoff(file_header.bfOffBits);
+}
+
+BmpScanlineWriter::~BmpScanlineWriter()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+void BmpScanlineWriter::write_rows(const uint8_t* rows, int32_t nrows)
+{
+    // BMP rows are stored bottom-up, so seek to where each one belongs
+    const char padding[4] = {0, 0, 0, 0};
+    for (int32_t i = 0; i < nrows; ++i) {
+        const int32_t stored_row = rows_ - 1 - (rows_written_ + i);
+        stream_.seekp(data_offset_ + std::streamoff(stored_row) *
+                                         std::streamoff(padded_row_size_));
+        stream_.write(reinterpret_cast<const char*>(rows + i * cols_), cols_);
+        stream_.write(padding, padded_row_size_ - cols_);
+    }
+}
+
+void BmpScanlineWriter::close()
+{
+    if (!stream_.is_open()) {
+        return;
+    }
+    stream_.close();
+    if (rows_written_ != rows_) {
+        throw IOException("Image closed before all rows were written");
+    }
+}
+
+// PNG
+
+PngScanlineReader::PngScanlineReader(const std::string& filename)
+{
+    unsigned width, height;
+    auto error = lodepng::decode(pixels_, width, height, filename,
+                                 LodePNGColorType::LCT_RGB, 8);
+    if (error) {
+        throw IOException("could not load png file");
+    }
+    rows_ = int32_t(height);
+    cols_ = int32_t(width);
+}
+
+void PngScanlineReader::read_rows(RgbPixel* out, int32_t nrows)
+{
+    const size_t row_bytes = size_t(cols_) * 3;
+    for (int32_t i = 0; i < nrows; ++i) {
+        unpack_row(pixels_.data() + size_t(rows_read_ + i) * row_bytes,
+                   out + i * cols_, cols_);
+    }
+}
+
+PngScanlineWriter::PngScanlineWriter(const std::string& filename,
+                                     int32_t rows,
+                                     int32_t cols)
+    : ScanlineWriter<RgbPixel>(png_size(rows), png_size(cols))
+    , stream_(filename, std::ios::binary | std::ios::trunc)
+    , prev_row_(size_t(cols) * 3, 0)
+    , cur_row_(size_t(cols) * 3)
+    , adler_(1)
+    , started_(false)
+{
+    if (!stream_) {
+        throw IOException("could not open png file for writing");
+    }
+
+    // Signature and IHDR: 8-bit RGB, deflate, adaptive filtering, no interlace
+    const uint8_t signature[8] = {0x89, 'P', 'N', 'G', '\r', '\n', 0x1a, '\n'};
+    stream_.write(reinterpret_cast<const char*>(signature), 8);
+    std::vector<uint8_t> ihdr;
+    append_be32(ihdr, uint32_t(cols));
+    append_be32(ihdr, uint32_t(rows));
+    ihdr.insert(std::end(ihdr), {8, 2, 0, 0, 0});
+    write_png_chunk(stream_, "IHDR", ihdr.data(), ihdr.size());
+}
+
+PngScanlineWriter::~PngScanlineWriter()
+{
+    try {
+        close();
+    } catch (const std::exception&) {
+    }
+}
+
+void PngScanlineWriter::write_rows(const RgbPixel* rows, int32_t nrows)
+{
+    for (int32_t i = 0; i < nrows; ++i) {
+        pack_row(rows + i * cols_, cur_row_.data(), cols_);
+        filter_scanline(cur_row_, prev_row_, 3, filtered_, pending_);
+        std::swap(cur_row_, prev_row_);
+
+        const bool last = (rows_written_ + i + 1 == rows_);
+        if (last || pending_.size() >= PNG_BAND_BYTES) {
+            flush_band(last);
+        }
+    }
+}
+
+// Deflate the pending scanlines as one piece of the zlib stream and write it
+// out as an IDAT chunk. The zlib header goes in front of the first piece and
+// the Adler32 of everything after the last one
+void PngScanlineWriter::flush_band(bool final)
+{
+    unsigned char* deflated = nullptr;
+    size_t deflated_size = 0;
+    auto error = lodepng_deflate_piece(&deflated, &deflated_size,
+                                       pending_.data(), pending_.size(),
+                                       &lodepng_default_compress_settings,
+                                       final ? 1 : 0);
+    if (error) {
+        std::free(deflated);
+        throw IOException("could not compress png data");
+    }
+
+    adler_ = lodepng_adler32_combine(
+        adler_, lodepng_adler32(pending_.data(), pending_.size()),
+        pending_.size());
+
+    std::vector<uint8_t> idat;
+    idat.reserve(deflated_size + 6);
+    if (!started_) {
+        idat.push_back(0x78);
+        idat.push_back(0x01);
+        started_ = true;
+    }
+    idat.insert(std::end(idat), deflated, deflated + deflated_size);
+    std::free(deflated);
+    if (final) {
+        append_be32(idat, adler_);
+    }
+    write_png_chunk(stream_, "IDAT", idat.data(), idat.size());
+    pending_.clear();
+}
+
+void PngScanlineWriter::close()
+{
+    if (!stream_.is_open()) {
+        return;
+    }
+    if (rows_written_ != rows_) {
+        stream_.close();
+        throw IOException("Image closed before all rows were written");
+    }
+    write_png_chunk(stream_, "IEND", nullptr, 0);
+    stream_.close();
+}
@@ -746,6 +746,15 @@ buffer. It cannot be used to create gzip files however, and it only supports the
 part of zlib that is required for PNG, it does not support dictionaries.
 */
 
+/*Calculate Adler32 of buffer (SIPL addition)*/
+unsigned lodepng_adler32(const unsigned char* buf, size_t len);
+
+/*
+Adler32 of the concatenation of two buffers, given the Adler32 of each and the length of the second
+one (SIPL addition). Works the same as zlib's adler32_combine.
+*/
+unsigned lodepng_adler32_combine(unsigned adler1, unsigned adler2, size_t len2);
+
 #ifdef LODEPNG_COMPILE_DECODER
 /*Inflate a buffer. Inflate is the decompression step of deflate. Out buffer must be freed after use.*/
 unsigned lodepng_inflate(unsigned char** out, size_t* outsize,
@@ -787,6 +796,16 @@ unsigned lodepng_deflate(unsigned char** out, size_t* outsize,
                          const unsigned char* in, size_t insize,
                          const LodePNGCompressSettings* settings);
 
+/*
+Compress one piece of a larger deflate stream (SIPL addition). With final = 0 the last block is not
+marked final and an empty stored block is appended, so the output ends on a byte boundary and the
+deflate output of the next piece can be concatenated directly after it (as pigz does). The last
+piece must be compressed with final = 1. lodepng_deflate is the same as this with final = 1.
+*/
+unsigned lodepng_deflate_piece(unsigned char** out, size_t* outsize,
+                               const unsigned char* in, size_t insize,
+                               const LodePNGCompressSettings* settings, unsigned final);
+
 #endif /*LODEPNG_COMPILE_ENCODER*/
 #endif /*LODEPNG_COMPILE_ZLIB*/
 